@@ -15,6 +15,9 @@
 #ifndef _ring_h_
 #define _ring_h_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,6 +31,16 @@ extern "C" {
  */
 #define RING_F_SP 0x01	/* Default push allow single producer. */
 #define RING_F_SC 0x02	/* Default pop allow single consumer. */
+#ifndef RING_INDEX64
+#define RING_F_MP_RTS 0x04	/* Default push with relaxed tail sync (RTS) multi producer. */
+#define RING_F_MP_HTS 0x08	/* Default push with head/tail sync (HTS) multi producer. */
+#define RING_F_MC_RTS 0x10	/* Default pop with relaxed tail sync (RTS) multi consumer. */
+#define RING_F_MC_HTS 0x20	/* Default pop with head/tail sync (HTS) multi consumer. */
+#endif
+#define RING_F_WAIT 0x40	/* Wake threads blocked in ring_push_wait/ring_pop_wait. */
+#define RING_F_NT 0x80	/* Push large copies with non-temporal stores (x86 only). */
+#define RING_F_EXACT_SZ 0x100	/* Ring holds exactly count elements, count need not be power of 2. */
+#define RING_F_SCRAMBLE 0x200	/* Consecutive slots on different cache lines. */
 
 /**
  * Behavior used when push and pop.
@@ -35,7 +48,28 @@ extern "C" {
 #define RING_B_FIXED 0		/* Push/Pop fixed number of objects on a ring. */
 #define RING_B_VARIABLE 1	/* Push/Pop as many objects as possible on a ring. */
 
+/**
+ * Backoff policy of the multi producer/consumer tail wait loops.
+ */
+#define RING_BACKOFF_SPIN 0	/* Pause, yield after RING_PAUSE_REP times (default). */
+#define RING_BACKOFF_EXP 1	/* Pause 1, 2, 4.. up to max times per wait, tpause if WAITPKG. */
+#define RING_BACKOFF_YIELD 2	/* Pause spin times, then yield. */
+#define RING_BACKOFF_FUTEX 3	/* Pause spin times, then sleep on the tail. */
+#define RING_BACKOFF_UMWAIT 4	/* Umwait on the tail for max pauses, RING_BACKOFF_EXP if no WAITPKG. */
+
+/**
+ * Define RING_INDEX64 to use 64bit head/tail indexes, rings up to
+ * 2^31 elements and no CAS ABA after index wraparound. There is no
+ * RTS/HTS sync in this mode, the RING_F_*_RTS/HTS flags are not
+ * defined so a build using them fails.
+ */
+#ifdef RING_INDEX64
+#define RING_SIZE_MASK (unsigned)(0x7fffffff)	/* Ring size mask. */
+#define RING_SIZE_MAX (unsigned)(0x80000000)	/* Max elements of a ring. */
+#else
 #define RING_SIZE_MASK (unsigned)(0x0fffffff)	/* Ring size mask. */
+#define RING_SIZE_MAX RING_SIZE_MASK	/* Max elements of a ring. */
+#endif
 
 /**
  * Yield after times of pause, no yield
@@ -45,7 +79,162 @@ extern "C" {
 #define RING_PAUSE_REP 0
 #endif
 
+/**
+ * Initial head/tail index of new rings, set it near the index
+ * wraparound (e.g. UINT32_MAX - 1000) to hit the wrap early.
+ */
+#ifndef RING_INIT_INDEX
+#define RING_INIT_INDEX 0
+#endif
+
+/**
+ * Invariant check of head/tail moves, define it as assert(x)
+ * in stress tests, no check by default.
+ */
+#ifndef RING_ASSERT
+#define RING_ASSERT(x) ((void)0)
+#endif
+
+/**
+ * Times of pause before ring_push_wait/ring_pop_wait
+ * sleep on the ring.
+ */
+#ifndef RING_WAIT_SPIN
+#define RING_WAIT_SPIN (RING_PAUSE_REP ? RING_PAUSE_REP : 1024)
+#endif
+
+/**
+ * Tsc ticks of one pause, converts the backoff max
+ * to tpause/umwait deadlines.
+ */
+#ifndef RING_PAUSE_TSC
+#define RING_PAUSE_TSC 140
+#endif
+
+/**
+ * Bytes of a copy from which push/pop use SIMD moves
+ * (AVX-512, AVX or NEON, as the build is compiled for).
+ * The vector copy wins from 64 bytes with AVX2 (ring_bench -x).
+ */
+#ifndef RING_COPY_SIMD_MIN
+#define RING_COPY_SIMD_MIN 64
+#endif
+
+/**
+ * Number of per thread stats slots of a ring, threads share
+ * slots if there are more threads, and then may lose counts
+ * as slots are updated without atomic read-modify-write.
+ */
+#ifndef RING_STATS_SLOTS
+#define RING_STATS_SLOTS 16
+#endif
+
+/**
+ * Define RING_PREFETCH to prefetch the ring slots the next pop
+ * reads, after each pop.
+ */
+
+/**
+ * Define RING_TRACE to sample the time objects stay in a ring, push
+ * stores the tsc of every RING_TRACE_SAMPLE th slot (power of 2) in an
+ * array after the ring data, pop adds the elapsed ticks to a log
+ * bucketed histogram of the ring, see ring_latency_histogram.
+ */
+#ifndef RING_TRACE_SAMPLE
+#define RING_TRACE_SAMPLE 64
+#endif
+
+#define RING_TRACE_SUB_BITS 2	/* Buckets per power of 2 as bits, within 25%. */
+#define RING_TRACE_BUCKETS ((65 - RING_TRACE_SUB_BITS) << RING_TRACE_SUB_BITS)
+
+/**
+ * Define RING_SET_SCAN to the polls of ring_set_pop between full
+ * scans of the member rings (e.g. 64), catching pushes not marked
+ * in the bits. Without it, pushes on a member ring must
+ * go through ring_set_push or be followed by ring_set_mark.
+ */
+
+/**
+ * Huge page size and hugetlbfs mount tried first by
+ * ring_create_shm, 0 to use shm_open only.
+ */
+#ifndef RING_HUGEPAGE_SIZE
+#define RING_HUGEPAGE_SIZE (2 << 20)
+#endif
+
+/**
+ * Max objects of a ring_mempool per thread cache.
+ */
+#ifndef RING_MEMPOOL_CACHE_MAX
+#define RING_MEMPOOL_CACHE_MAX 512
+#endif
+
+/**
+ * Bytes between the producer, consumer and data areas of a ring, so
+ * each sits in its own prefetch region: 128 on x86_64 (the adjacent
+ * line prefetcher pulls 128 byte pairs), aarch64 (128 byte lines of
+ * Apple M, pair prefetch of Neoverse) and POWER (128 byte lines), else
+ * the cache line. Rings must be allocated aligned to it.
+ */
+#ifndef RING_CACHE_PAD
+#if defined(__x86_64__) || defined(__aarch64__) || defined(__powerpc64__)
+#define RING_CACHE_PAD 128
+#elif defined(CACHE_LINE_SIZE)
+#define RING_CACHE_PAD CACHE_LINE_SIZE
+#else
+#define RING_CACHE_PAD 64
+#endif
+#endif
+
+/**
+ * Max objects moved by one ring_deque_steal_half.
+ */
+#ifndef RING_DEQUE_STEAL_MAX
+#define RING_DEQUE_STEAL_MAX 128
+#endif
+
+#ifndef RING_NUMA_MAX_NODES
+#define RING_NUMA_MAX_NODES 1024	/* Size of node mask passed to mbind. */
+#endif
+
+#ifndef RING_HUGEPAGE_DIR
+#define RING_HUGEPAGE_DIR "/dev/hugepages"
+#endif
+
 struct ring;
+struct ring_set;
+struct ring_prio;
+struct ring_bcast;
+struct ring_dyn;
+struct ring_deque;
+
+/**
+ * Statistics of a ring, collected if RING_STATS is defined.
+ */
+struct ring_stats {
+	uint64_t push_ok;		/* Number of successful push. */
+	uint64_t push_fail;		/* Number of failed push for no room. */
+	uint64_t push_objs;		/* Number of objects pushed. */
+	uint64_t push_retry;	/* Number of producer head CAS retries. */
+	uint64_t push_spin;		/* Number of producer spins waiting for tail. */
+	uint64_t pop_ok;		/* Number of successful pop. */
+	uint64_t pop_fail;		/* Number of failed pop for no entry. */
+	uint64_t pop_objs;		/* Number of objects poped. */
+	uint64_t pop_retry;		/* Number of consumer head CAS retries. */
+	uint64_t pop_spin;		/* Number of consumer spins waiting for tail. */
+	uint64_t max_count;		/* High water mark of entries in the ring. */
+};
+
+/**
+ * Zero copy spans of ring slots, returned by ring_push_start/ring_pop_start.
+ * The reserved slots may wrap around the end of the ring data area, then
+ * the first n1 slots are at ptr1 and the rest at ptr2.
+ */
+struct ring_zc_data {
+	void *ptr1;		/* First span of slots in the ring data area. */
+	unsigned n1;	/* Number of slots in the first span. */
+	void *ptr2;		/* Second span at the ring start, NULL if no wraparound. */
+};
 
 /**
  * Calculate the memory size needed for a ring structure.
@@ -56,7 +245,7 @@ struct ring;
  *		The memory size needed for the ring on success.
  *		Or 0 if count is not power of 2 or greater than ring size mask.
  */
-RING_API unsigned ring_memsize(unsigned count);
+RING_API size_t ring_memsize(unsigned count);
 
 
 /**
@@ -70,6 +259,25 @@ RING_API unsigned ring_memsize(unsigned count);
  *		Or of the following:
  *		- RING_F_SP:  If the flag is set, only allow one producer.
  *		- RING_F_SC:  If the flag is set, only allow one consumer.
+ *		- RING_F_MP_RTS:  Multi producer with relaxed tail sync, a producer
+ *		  never waits for a given predecessor to update tail.
+ *		- RING_F_MP_HTS:  Multi producer with head/tail sync, producers
+ *		  are serialized through one 64bit head/tail word.
+ *		- RING_F_MC_RTS:  Multi consumer with relaxed tail sync.
+ *		- RING_F_MC_HTS:  Multi consumer with head/tail sync.
+ *		  The RTS/HTS flags are not defined with RING_INDEX64.
+ *		- RING_F_WAIT:  Push and pop wake the threads blocked in
+ *		  ring_push_wait and ring_pop_wait, costs a full fence per call.
+ *		- RING_F_NT:  Push copies of RING_COPY_SIMD_MIN bytes or more
+ *		  bypass the cache, for rings much larger than the LLC.
+ *		- RING_F_EXACT_SZ:  The ring holds exactly count elements instead
+ *		  of count - 1, count may be any value and the data area is
+ *		  rounded up to a power of 2, see ring_exact_memsize.
+ *		- RING_F_SCRAMBLE:  Slot i + 1 is on the cache line after slot i,
+ *		  so single object pushes of producers on different cores do not
+ *		  share a line. Elements are copied one by one, zero copy push
+ *		  and pop are not allowed. Needs an esize of power of 2 less than
+ *		  CACHE_LINE_SIZE and two lines at least, ignored if not.
  * @return
  *		no return.
  */
@@ -114,417 +322,4364 @@ RING_API unsigned ring_pop(struct ring *r, void **objs, unsigned n, int behavior
 
 
 /**
- * Test if a ring is full.
+ * Calculate the memory size needed for a ring of fixed size elements.
  *
- * @param r
- *		A pointer to the ring structure.
+ * @param count
+ *		The number of elements in the ring (must be power of 2).
+ * @param esize
+ *		The size of ring element, in bytes (must be multiple of 4).
  * @return
- *		- 1:  The ring is full.
- *		- 0:  The ring is not full.
+ *		The memory size needed for the ring on success.
+ *		Or 0 if count is not power of 2 or greater than ring size mask,
+ *		or esize is not multiple of 4.
  */
-RING_API int ring_full(const struct ring *r);
+RING_API size_t ring_elem_memsize(unsigned count, unsigned esize);
 
 
 /**
- * Test if a ring is empty.
+ * Calculate the memory size needed for a RING_F_EXACT_SZ ring.
  *
- * @param r
- *		A pointer to the ring structure.
+ * @param count
+ *		The number of elements the ring holds (any value).
  * @return
- *		- 1:  The ring is empty.
- *		- 0:  The ring is not empty.
+ *		The memory size needed for the ring on success.
+ *		Or 0 if count is 0, or over RING_SIZE_MAX once rounded up to
+ *		power of 2, i.e. over 2^27 without RING_INDEX64.
  */
-RING_API int ring_empty(const struct ring *r);
+RING_API size_t ring_exact_memsize(unsigned count);
 
 
 /**
- * Return the number of entries in a ring.
+ * Calculate the memory size needed for a RING_F_EXACT_SZ ring of
+ * fixed size elements.
+ *
+ * @param count
+ *		The number of elements the ring holds (any value).
+ * @param esize
+ *		The size of ring element, in bytes (must be multiple of 4).
+ * @return
+ *		The memory size needed for the ring on success.
+ *		Or 0 if count is 0, or over RING_SIZE_MAX once rounded up to
+ *		power of 2 (over 2^27 without RING_INDEX64), or esize is not
+ *		multiple of 4.
+ */
+RING_API size_t ring_elem_exact_memsize(unsigned count, unsigned esize);
+
+
+/**
+ * Initialize a ring structure of fixed size elements, the elements
+ * are copied into the ring data area instead of stored as pointers.
  *
  * @param r
- *		A pointer to the ring structure.
+ *		The pointer to the ring structure.
+ * @param count
+ *		The number of elements in the ring (must be power of 2
+ *		unless RING_F_EXACT_SZ).
+ * @param esize
+ *		The size of ring element, in bytes (must be multiple of 4).
+ * @param flags
+ *		Same as ring_init.
  * @return
- *		The number of entries in the ring.
+ *		no return.
  */
-RING_API unsigned ring_count(const struct ring *r);
+RING_API void ring_elem_init(struct ring *r, unsigned count, unsigned esize, unsigned flags);
 
 
 /**
- * Return the number of free entries in a ring.
+ * Push several elements on the ring.
  *
  * @param r
- *		A pointer to the ring structure.
+ * 		A pointer to the ring structure.
+ * @param objs
+ *		A pointer to an array of elements, esize bytes each, to pushed.
+ * @param n
+ *		The number of elements to add on the ring.
+ * @param behavior
+ *		RING_B_FIXED:	Push a fixed number of elements to a ring.
+ *		RING_B_VARIABLE:Push as many elements as possible to a ring.
  * @return
- *		The number of free entries in the ring.
+ *		- 0: Not enough room in the ring to push, no element is pushed.
+ *		- n: Number of elements pushed.
  */
-RING_API unsigned ring_avail(const struct ring *r);
+RING_API unsigned ring_elem_push(struct ring *r, const void *objs, unsigned n, int behavior);
 
 
-#ifdef __cplusplus
-}
-#endif
+/**
+ * Pop several elements from a ring.
+ *
+ * @param r
+ * 		A pointer to the ring structure.
+ * @param objs
+ *		A pointer to an array of elements, esize bytes each, will be filled.
+ * @param n
+ *		The number of elements to pop from the ring.
+ * @param behavior
+ *		RING_B_FIXED:	Pop a fixed number of elements from a ring.
+ *		RING_B_VARIABLE:Pop as many elements as possible from a ring.
+ * @return
+ *		- O: Not enough entries in the ring to pop, no element is poped.
+ *		- n: Actual number of elements poped.
+ */
+RING_API unsigned ring_elem_pop(struct ring *r, void *objs, unsigned n, int behavior);
 
-#endif // _ring_h_
 
+/**
+ * Push as many objects as possible on the ring, and return the free
+ * slots left, computed by the push without reading indexes again.
+ *
+ * @param r
+ * 		A pointer to the ring structure.
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) to pushed.
+ * @param n
+ *		The number of objects to add on the ring.
+ * @param free_space
+ *		The free slots in the ring after push, may be less than ring_avail
+ *		as the consumers go on.
+ * @return
+ *		Number of objects pushed.
+ */
+RING_API unsigned ring_push_burst(struct ring *r, void * const *objs, unsigned n, unsigned *free_space);
 
-#ifdef RING_IMPLEMENTATION
 
 /**
- * Implement
+ * Pop as many objects as possible from a ring, and return the entries
+ * left, computed by the pop without reading indexes again.
+ *
+ * @param r
+ * 		A pointer to the ring structure.
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) that will be filled.
+ * @param n
+ *		The number of objects to pop from the ring.
+ * @param available
+ *		The entries in the ring after pop, may be less than ring_count
+ *		as the producers go on.
+ * @return
+ *		Number of objects poped.
  */
+RING_API unsigned ring_pop_burst(struct ring *r, void **objs, unsigned n, unsigned *available);
 
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
 
-#include <inttypes.h>
-#include <emmintrin.h>
-#include <sched.h>
+/**
+ * Same as ring_pop, and prefetch the objects poped, so they are loaded
+ * while the caller goes on with the first ones.
+ */
+RING_API unsigned ring_pop_prefetch(struct ring *r, void **objs, unsigned n, int behavior);
 
-#include <stddef.h>
-#ifndef offsetof
-#define offsetof(s,m) __builtin_offsetof(s,m)
-#endif
 
-#ifndef likely
-#define likely(x) __builtin_expect((x),1)
-#endif
+/**
+ * Same as ring_push_burst, push elements of an element ring.
+ */
+RING_API unsigned ring_elem_push_burst(struct ring *r, const void *objs, unsigned n, unsigned *free_space);
 
-#ifndef unlikely
-#define unlikely(x) __builtin_expect((x),0)
-#endif
 
-#ifndef CACHE_LINE_SIZE
-#define CACHE_LINE_SIZE 64
-#endif
+/**
+ * Same as ring_pop_burst, pop elements of an element ring.
+ */
+RING_API unsigned ring_elem_pop_burst(struct ring *r, void *objs, unsigned n, unsigned *available);
 
-#define cache_aligned __attribute__((__aligned__(CACHE_LINE_SIZE)))
 
-#define compiler_barrier() do { \
-	asm volatile("":::"memory"); \
-} while (0)
+/**
+ * Start to push several slots on a SP or HTS producer ring in place (zero copy).
+ * The slots are reserved by moving prod.head, the caller fills them through
+ * zcd and then publishes them by ring_push_finish. One slot is sizeof(void *)
+ * bytes for pointer rings, or esize bytes for element rings.
+ *
+ * @param r
+ * 		A pointer to the ring structure (must be RING_F_SP or RING_F_MP_HTS).
+ * @param n
+ *		The number of slots to reserve on the ring.
+ * @param behavior
+ *		RING_B_FIXED:	Reserve a fixed number of slots on a ring.
+ *		RING_B_VARIABLE:Reserve as many slots as possible on a ring.
+ * @param zcd
+ *		A pointer to the spans of reserved slots that will be filled.
+ * @return
+ *		- 0: Not enough room in the ring, not a SP/HTS producer ring,
+ *		  or a RING_F_SCRAMBLE ring.
+ *		- n: Number of slots reserved.
+ */
+RING_API unsigned ring_push_start(struct ring *r, unsigned n, int behavior, struct ring_zc_data *zcd);
 
-/* True if x is power of 2. */
-#define POWEROF2(x) ((((x)-1) & (x)) == 0)
 
-#define CAS(p,o,n) __sync_bool_compare_and_swap(p,o,n)
+/**
+ * Finish to push the slots reserved by ring_push_start.
+ *
+ * @param r
+ * 		A pointer to the ring structure.
+ * @param n
+ *		The number of slots filled and published, at most the number
+ *		reserved, the rest of reserved slots are given back.
+ * @return
+ *		no return.
+ */
+RING_API void ring_push_finish(struct ring *r, unsigned n);
 
-struct ring {
-	/* Ring producer struct. */
-	struct prod {
-		uint32_t sp;
-		uint32_t size;
-		uint32_t mask;
-		volatile uint32_t head;
-		volatile uint32_t tail;
-	} prod cache_aligned;
 
-	/* Ring consumer struct. */
-	struct cons {
-		uint32_t sc;
-		uint32_t size;
-		uint32_t mask;
-		volatile uint32_t head;
-		volatile uint32_t tail;
-	} cons cache_aligned;
+/**
+ * Start to pop several slots from a SC or HTS consumer ring in place (zero copy).
+ * The entries are reserved by moving cons.head, the caller reads them through
+ * zcd and then releases them by ring_pop_finish.
+ *
+ * @param r
+ * 		A pointer to the ring structure (must be RING_F_SC or RING_F_MC_HTS).
+ * @param n
+ *		The number of entries to reserve from the ring.
+ * @param behavior
+ *		RING_B_FIXED:	Reserve a fixed number of entries from a ring.
+ *		RING_B_VARIABLE:Reserve as many entries as possible from a ring.
+ * @param zcd
+ *		A pointer to the spans of reserved entries that will be filled.
+ * @return
+ *		- 0: Not enough entries in the ring, not a SC/HTS consumer ring,
+ *		  or a RING_F_SCRAMBLE ring.
+ *		- n: Number of entries reserved.
+ */
+RING_API unsigned ring_pop_start(struct ring *r, unsigned n, int behavior, struct ring_zc_data *zcd);
 
-	/* Memory space of ring data. */
-	void *ring[0] cache_aligned;
-};
 
-/* Align x to next power of 2. */
-static inline uint32_t
-align32_pow2(uint32_t x) {
-	x--;
-	x |= x >> 1;
-	x |= x >> 2;
-	x |= x >> 4;
-	x |= x >> 8;
-	x |= x >> 16;
+/**
+ * Finish to pop the entries reserved by ring_pop_start.
+ *
+ * @param r
+ * 		A pointer to the ring structure.
+ * @param n
+ *		The number of entries consumed and released, at most the number
+ *		reserved, the rest of reserved entries are given back.
+ * @return
+ *		no return.
+ */
+RING_API void ring_pop_finish(struct ring *r, unsigned n);
 
-	return x + 1;
-}
 
-/* Align 64bit x to next power of 2. */
-static inline uint64_t
-align64_pow2(uint64_t x) {
-	x--;
-	x |= x >> 1;
-	x |= x >> 2;
-	x |= x >> 4;
-	x |= x >> 8;
-	x |= x >> 16;
-	x |= x >> 32;
+/**
+ * Copy the next objects of a SC consumer ring without popping them,
+ * they stay in the ring until ring_pop_commit.
+ *
+ * @param r
+ * 		A pointer to the ring structure (must be RING_F_SC).
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) that will be filled.
+ * @param n
+ *		The max number of objects to peek.
+ * @return
+ *		Number of objects peeked, 0 if none or not a SC ring.
+ */
+RING_API unsigned ring_peek(struct ring *r, void **objs, unsigned n);
 
-	return x + 1;
-}
 
-RING_API unsigned
-ring_memsize(unsigned count) {
-	unsigned sz;
+/**
+ * Same as ring_peek, peek elements of an element ring.
+ */
+RING_API unsigned ring_elem_peek(struct ring *r, void *objs, unsigned n);
 
-	if ((!POWEROF2(count)) || (count > RING_SIZE_MASK)) {
-		return 0;
-	}
-	sz = sizeof(struct ring) + count * sizeof(void *);
-	return sz;
-}
 
-RING_API void
-ring_init(struct ring *r, unsigned count, unsigned flags) {
-	memset(r, 0, sizeof(*r));
-	r->prod.sp = !!(flags & RING_F_SP);
-	r->cons.sc = !!(flags & RING_F_SC);
-	r->prod.size = r->cons.size = count;
-	r->prod.mask = r->cons.mask = count - 1;
-	r->prod.head = r->cons.head = 0;
-	r->prod.tail = r->cons.tail = 0;
+/**
+ * Pop the first n objects of a SC consumer ring, after ring_peek.
+ *
+ * @param r
+ * 		A pointer to the ring structure (must be RING_F_SC).
+ * @param n
+ *		The number of objects to pop, at most the number peeked.
+ * @return
+ *		no return.
+ */
+RING_API void ring_pop_commit(struct ring *r, unsigned n);
+
+
+/**
+ * Push several objects on the ring, wait for room if the ring is full.
+ * Spin RING_WAIT_SPIN times first, then sleep until a consumer pops if
+ * the ring is RING_F_WAIT, or keep spinning and yield if not.
+ *
+ * @param r
+ * 		A pointer to the ring structure.
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) to pushed.
+ * @param n
+ *		The number of objects to add on the ring.
+ * @param behavior
+ *		RING_B_FIXED:	Push a fixed number of objects to a ring.
+ *		RING_B_VARIABLE:Push as many objects as possible to a ring.
+ * @param timeout
+ *		Max time to wait in milliseconds, -1 to wait forever.
+ * @return
+ *		- 0: Timeout, no object is pushed, or RING_B_FIXED with n
+ *		  greater than the ring capacity (no wait).
+ *		- n: Number of objects pushed.
+ */
+RING_API unsigned ring_push_wait(struct ring *r, void * const *objs, unsigned n, int behavior, int timeout);
+
+
+/**
+ * Pop several objects from a ring, wait for entries if the ring is empty.
+ * Spin RING_WAIT_SPIN times first, then sleep until a producer pushes if
+ * the ring is RING_F_WAIT, or keep spinning and yield if not.
+ *
+ * @param r
+ * 		A pointer to the ring structure.
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) that will be filled.
+ * @param n
+ *		The number of objects to pop from the ring.
+ * @param behavior
+ *		RING_B_FIXED:	Pop a fixed number of objects from a ring.
+ *		RING_B_VARIABLE:Pop as many objects as possible from a ring.
+ * @param timeout
+ *		Max time to wait in milliseconds, -1 to wait forever.
+ * @return
+ *		- 0: Timeout, no object is poped, or RING_B_FIXED with n
+ *		  greater than the ring capacity (no wait).
+ *		- n: Actual number of objects poped.
+ */
+RING_API unsigned ring_pop_wait(struct ring *r, void **objs, unsigned n, int behavior, int timeout);
+
+
+/**
+ * Same as ring_push_wait, push elements of an element ring.
+ */
+RING_API unsigned ring_elem_push_wait(struct ring *r, const void *objs, unsigned n, int behavior, int timeout);
+
+
+/**
+ * Same as ring_pop_wait, pop elements of an element ring.
+ */
+RING_API unsigned ring_elem_pop_wait(struct ring *r, void *objs, unsigned n, int behavior, int timeout);
+
+
+/**
+ * Attach eventfds notified by the ring, so the ring can be polled by
+ * epoll. An armed eventfd is written once after the ring changes.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @param prod_fd
+ *		The eventfd written after push when armed by ring_pop_arm, -1 for none.
+ * @param cons_fd
+ *		The eventfd written after pop when armed by ring_push_arm, -1 for none.
+ * @return
+ *		no return.
+ */
+RING_API void ring_set_eventfd(struct ring *r, int prod_fd, int cons_fd);
+
+
+/**
+ * Set how push and pop wait for other producers/consumers to finish
+ * their tail update (multi producer/consumer, RTS and HTS), must be
+ * called before the ring is used.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @param policy
+ *		- RING_BACKOFF_SPIN:  Pause, for latency critical rings.
+ *		- RING_BACKOFF_EXP:  Exponential pause up to max pauses per wait,
+ *		  yield after RING_PAUSE_REP waits as RING_BACKOFF_SPIN.
+ *		- RING_BACKOFF_YIELD:  Pause spin times, then yield the cpu.
+ *		- RING_BACKOFF_FUTEX:  Pause spin times, then sleep until the
+ *		  tail is updated, for oversubscribed threads. Push and pop
+ *		  pay a full fence as RING_F_WAIT.
+ *		- RING_BACKOFF_UMWAIT:  Umwait until the tail cache line is
+ *		  written or max pauses pass, needs WAITPKG (-mwaitpkg).
+ * @param spin
+ *		Pauses before yield or sleep.
+ * @param max
+ *		Max pauses of one exponential or umwait step (at least 1).
+ * @return
+ *		no return.
+ */
+RING_API void ring_set_backoff(struct ring *r, unsigned policy, unsigned spin, unsigned max);
+
+
+/**
+ * Arm the prod_fd before a consumer polls it for entries.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		- 0: Armed and the ring is empty, safe to poll.
+ *		- 1: The ring is not empty, pop again before poll.
+ */
+RING_API int ring_pop_arm(struct ring *r);
+
+
+/**
+ * Arm the cons_fd before a producer polls it for room.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		- 0: Armed and the ring is full, safe to poll.
+ *		- 1: The ring is not full, push again before poll.
+ */
+RING_API int ring_push_arm(struct ring *r);
+
+
+/**
+ * Create a ring in a named shared memory segment, so other processes
+ * can attach it by name. The ring is placed after a header holding a
+ * magic, version and layout, the segment is a file of RING_HUGEPAGE_DIR
+ * if it is a hugetlbfs mount with free pages, or a shm_open segment
+ * if not.
+ * Threads blocked in ring_push_wait/ring_pop_wait are woken across
+ * processes, eventfds can not be shared and must not be set.
+ *
+ * @param name
+ *		The name of the segment, as of shm_open ("/name").
+ * @param count
+ *		The number of elements in the ring (must be power of 2).
+ * @param flags
+ *		Same as ring_init.
+ * @return
+ *		The pointer to the ring on success.
+ *		Or NULL with errno set, EEXIST if the name already exists
+ *		in either place.
+ */
+RING_API struct ring *ring_create_shm(const char *name, unsigned count, unsigned flags);
+
+
+/**
+ * Same as ring_create_shm, create an element ring with esize bytes
+ * elements stored in the segment (no pointers).
+ */
+RING_API struct ring *ring_elem_create_shm(const char *name, unsigned count, unsigned esize, unsigned flags);
+
+
+/**
+ * Attach a ring created by ring_create_shm, the header is checked
+ * against the layout of this build.
+ *
+ * @param name
+ *		The name of the segment.
+ * @return
+ *		The pointer to the ring on success.
+ *		Or NULL with errno set, EAGAIN if the ring is not created yet,
+ *		EPROTO if the header does not match.
+ */
+RING_API struct ring *ring_attach_shm(const char *name);
+
+
+/**
+ * Unmap a ring created or attached in shared memory.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		no return.
+ */
+RING_API void ring_detach_shm(struct ring *r);
+
+
+/**
+ * Remove the name of a shared memory ring, the ring is freed after
+ * all processes detach it.
+ *
+ * @param name
+ *		The name of the segment.
+ * @return
+ *		0 on success, -1 with errno set if not found.
+ */
+RING_API int ring_unlink_shm(const char *name);
+
+
+/**
+ * Write the indexes and the occupied slots of an idle ring to a file,
+ * the range from cons.tail to prod.tail in one writev (two segments if
+ * it wraps), to restore it at restart. Producers and consumers must be
+ * stopped.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @param fd
+ *		The file descriptor to write to, at its current offset.
+ * @return
+ *		0 on success, -1 with errno set if write failed.
+ */
+RING_API int ring_snapshot(const struct ring *r, int fd);
+
+
+/**
+ * Restore a snapshot of ring_snapshot into an idle ring of the same
+ * size, capacity and element size, e.g. a ring just initialized or
+ * created in shared memory. The elements keep their indexes. A ring
+ * holding elements, or with a push or pop in progress, is not idle and
+ * is left as is, without reading fd.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @param fd
+ *		The file descriptor to read from, at its current offset.
+ * @return
+ *		0 on success, -1 with errno set, EBUSY if the ring is not idle,
+ *		EPROTO if the snapshot does not match the ring, EIO if it is
+ *		truncated.
+ */
+RING_API int ring_restore(struct ring *r, int fd);
+
+
+/**
+ * Create a ring with its memory bound to a numa node, the pages are
+ * faulted in at create so the data area is placed before first use.
+ * Rings of RING_HUGEPAGE_SIZE or more are aligned for transparent
+ * huge pages, and fall back to small pages if none is free.
+ *
+ * @param count
+ *		The number of elements in the ring (must be power of 2
+ *		unless RING_F_EXACT_SZ).
+ * @param flags
+ *		Same as ring_init.
+ * @param node
+ *		The numa node to allocate on, or -1 for the local policy.
+ * @return
+ *		The pointer to the ring on success.
+ *		Or NULL with errno set, EINVAL if count or node is invalid.
+ */
+RING_API struct ring *ring_create_numa(unsigned count, unsigned flags, int node);
+
+
+/**
+ * Same as ring_create_numa, create an element ring with esize bytes
+ * elements stored in the ring (no pointers).
+ */
+RING_API struct ring *ring_elem_create_numa(unsigned count, unsigned esize, unsigned flags, int node);
+
+
+/**
+ * Free a ring created by ring_create_numa.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		no return.
+ */
+RING_API void ring_free_numa(struct ring *r);
+
+
+/**
+ * Get the numa node the data area of a ring lives on, works for any
+ * ring however it is allocated.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		The node of the first page of the data area.
+ *		Or -1 with errno set if not known.
+ */
+RING_API int ring_numa_node(const struct ring *r);
+
+
+/**
+ * Get the statistics of a ring, all zero if RING_STATS is not defined.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @param stats
+ *		A pointer to the statistics that will be filled.
+ * @return
+ *		no return.
+ */
+RING_API void ring_stats_get(const struct ring *r, struct ring_stats *stats);
+
+
+/**
+ * Reset the statistics of a ring.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		no return.
+ */
+RING_API void ring_stats_reset(struct ring *r);
+
+
+/**
+ * Get the push to pop latency histogram of a ring, the counts of the
+ * sampled objects by tsc ticks, all zero if RING_TRACE is not defined.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @param buckets
+ *		An array of RING_TRACE_BUCKETS counts that will be filled,
+ *		bucket i counts ticks from ring_latency_bucket(i) to
+ *		ring_latency_bucket(i + 1) - 1.
+ * @return
+ *		The number of samples.
+ */
+RING_API uint64_t ring_latency_histogram(const struct ring *r, uint64_t *buckets);
+
+
+/**
+ * Return the lowest tsc ticks counted in the histogram bucket i.
+ */
+RING_API uint64_t ring_latency_bucket(unsigned i);
+
+
+/**
+ * Return the ticks under which a fraction of the samples of a histogram
+ * filled by ring_latency_histogram are, the lowest ticks of the bucket.
+ *
+ * @param buckets
+ *		The histogram.
+ * @param q
+ *		The fraction, 0.99 for p99.
+ * @return
+ *		The ticks, 0 if the histogram is empty.
+ */
+RING_API uint64_t ring_latency_percentile(const uint64_t *buckets, double q);
+
+
+/**
+ * Reset the latency histogram of a ring.
+ */
+RING_API void ring_latency_reset(struct ring *r);
+
+
+/**
+ * Test if a ring is full.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		- 1:  The ring is full.
+ *		- 0:  The ring is not full.
+ */
+RING_API int ring_full(const struct ring *r);
+
+
+/**
+ * Test if a ring is empty.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		- 1:  The ring is empty.
+ *		- 0:  The ring is not empty.
+ */
+RING_API int ring_empty(const struct ring *r);
+
+
+/**
+ * Return the number of entries in a ring.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		The number of entries in the ring.
+ */
+RING_API unsigned ring_count(const struct ring *r);
+
+
+/**
+ * Return the number of free entries in a ring.
+ *
+ * @param r
+ *		A pointer to the ring structure.
+ * @return
+ *		The number of free entries in the ring.
+ */
+RING_API unsigned ring_avail(const struct ring *r);
+
+
+/**
+ * Calculate the memory size needed for a ring set, which polls several
+ * SC rings (one per producer thread) from one consumer.
+ *
+ * @param max
+ *		The max number of rings in the set.
+ * @return
+ *		The memory size needed for the ring set, 0 if max is 0.
+ */
+RING_API unsigned ring_set_memsize(unsigned max);
+
+
+/**
+ * Initialize a ring set.
+ *
+ * @param set
+ *		The pointer to the ring set structure.
+ * @param max
+ *		The max number of rings in the set.
+ * @return
+ *		no return.
+ */
+RING_API void ring_set_init(struct ring_set *set, unsigned max);
+
+
+/**
+ * Add a ring to a ring set, before any push or pop on the set.
+ *
+ * @param set
+ *		A pointer to the ring set structure.
+ * @param r
+ *		A pointer to the ring, only popped by the set consumer, and
+ *		pushed by ring_set_push, or by other functions followed by
+ *		ring_set_mark, a push not marked may never be popped.
+ * @param weight
+ *		The max objects popped from the ring in a turn, 0 for no limit.
+ * @return
+ *		The index of the ring in the set, -1 if the set is full.
+ */
+RING_API int ring_set_add(struct ring_set *set, struct ring *r, unsigned weight);
+
+
+/**
+ * Push several objects on the ring idx of a ring set, and mark it
+ * non-empty for the set consumer.
+ *
+ * @param set
+ *		A pointer to the ring set structure.
+ * @param idx
+ *		The index of the ring returned by ring_set_add.
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) to pushed.
+ * @param n
+ *		The number of objects to add on the ring.
+ * @param behavior
+ *		Same as ring_push.
+ * @return
+ *		Number of objects pushed.
+ */
+RING_API unsigned ring_set_push(struct ring_set *set, unsigned idx, void * const *objs, unsigned n, int behavior);
+
+
+/**
+ * Mark the ring idx of a ring set non-empty, after objects are pushed
+ * on it by other functions than ring_set_push.
+ *
+ * @param set
+ *		A pointer to the ring set structure.
+ * @param idx
+ *		The index of the ring returned by ring_set_add.
+ * @return
+ *		no return.
+ */
+RING_API void ring_set_mark(struct ring_set *set, unsigned idx);
+
+
+/**
+ * Pop objects from the non-empty rings of a ring set into one burst,
+ * round robin from the ring after the last one popped, at most the
+ * weight of a ring in its turn. Single consumer only.
+ *
+ * @param set
+ *		A pointer to the ring set structure.
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) that will be filled.
+ * @param n
+ *		The max number of objects to pop.
+ * @return
+ *		Number of objects poped.
+ */
+RING_API unsigned ring_set_pop(struct ring_set *set, void **objs, unsigned n);
+
+
+/**
+ * Max lanes of a priority ring.
+ */
+#define RING_PRIO_MAX_LANES 64
+
+/**
+ * Calculate the memory size needed for a priority ring, lanes single
+ * consumer rings of pointers popped by one consumer, lane 0 first.
+ *
+ * @param lanes
+ *		The number of priority lanes (1 to RING_PRIO_MAX_LANES).
+ * @param count
+ *		The number of elements of each lane ring (must be power of 2
+ *		unless the lanes are RING_F_EXACT_SZ).
+ * @return
+ *		The memory size needed for the priority ring, or 0 if lanes
+ *		or count is invalid, as ring_exact_memsize.
+ */
+RING_API size_t ring_prio_memsize(unsigned lanes, unsigned count);
+
+
+/**
+ * Initialize a priority ring, all lanes are strict.
+ *
+ * @param p
+ *		The pointer to the priority ring structure.
+ * @param lanes
+ *		The number of priority lanes.
+ * @param count
+ *		The number of elements of each lane ring, same as ring_prio_memsize.
+ * @param flags
+ *		Same as ring_init for the lane rings, RING_F_SC is implied.
+ * @return
+ *		0 on success, or -1 with errno EINVAL if lanes or count is
+ *		invalid, count not power of 2 without RING_F_EXACT_SZ.
+ */
+RING_API int ring_prio_init(struct ring_prio *p, unsigned lanes, unsigned count, unsigned flags);
+
+
+/**
+ * Set the weight of a lane, before any push or pop.
+ *
+ * @param p
+ *		A pointer to the priority ring structure.
+ * @param lane
+ *		The lane index.
+ * @param weight
+ *		0: strict, the lane is drained before any lower lane.
+ *		Or the max objects popped from the lane in its turn, the weighted
+ *		lanes share what strict lanes leave round robin.
+ * @return
+ *		no return.
+ */
+RING_API void ring_prio_set_weight(struct ring_prio *p, unsigned lane, unsigned weight);
+
+
+/**
+ * Push several objects on a lane of a priority ring, and mark the
+ * lane non-empty for the consumer.
+ *
+ * @param p
+ *		A pointer to the priority ring structure.
+ * @param lane
+ *		The lane index, 0 is the highest priority.
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) to pushed.
+ * @param n
+ *		The number of objects to add on the lane.
+ * @param behavior
+ *		Same as ring_push.
+ * @return
+ *		Number of objects pushed.
+ */
+RING_API unsigned ring_prio_push(struct ring_prio *p, unsigned lane, void * const *objs, unsigned n, int behavior);
+
+
+/**
+ * Pop objects of a priority ring into one burst, strict lanes first in
+ * priority order, then the weighted lanes round robin. Only non-empty
+ * lanes are read. Single consumer only.
+ *
+ * @param p
+ *		A pointer to the priority ring structure.
+ * @param objs
+ *		A pointer to a list of void * pointers (objects) that will be filled.
+ * @param n
+ *		The max number of objects to pop.
+ * @return
+ *		Number of objects poped.
+ */
+RING_API unsigned ring_prio_pop(struct ring_prio *p, void **objs, unsigned n);
+
+
+/**
+ * Return the ring of a lane, for ring_count and the other queries,
+ * push with ring_prio_push only, it marks the lane non-empty.
+ */
+RING_API struct ring *ring_prio_lane(struct ring_prio *p, unsigned lane);
+
+
+/**
+ * Calculate the memory size needed for a broadcast ring, where a single
+ * producer pushes elements and every reader pops all of them.
+ *
+ * @param count
+ *		The number of elements in the ring (must be power of 2).
+ * @param esize
+ *		The size of ring element, in bytes (must be multiple of 4).
+ * @param readers
+ *		The number of readers.
+ * @return
+ *		The memory size needed for the ring on success.
+ *		Or 0 if count or esize is invalid as ring_elem_memsize, or no reader.
+ */
+RING_API size_t ring_bcast_memsize(unsigned count, unsigned esize, unsigned readers);
+
+
+/**
+ * Initialize a broadcast ring, each reader has its own cursor
+ * in its own cache line, readers never contend with each other.
+ *
+ * @param b
+ *		The pointer to the broadcast ring structure.
+ * @param count
+ *		The number of elements in the ring (must be power of 2).
+ * @param esize
+ *		The size of ring element, in bytes (must be multiple of 4).
+ * @param readers
+ *		The number of readers, identified by 0 to readers - 1.
+ * @return
+ *		no return.
+ */
+RING_API void ring_bcast_init(struct ring_bcast *b, unsigned count, unsigned esize, unsigned readers);
+
+
+/**
+ * Push several elements on a broadcast ring, room is limited by the
+ * slowest reader. Single producer only.
+ *
+ * @param b
+ *		A pointer to the broadcast ring structure.
+ * @param objs
+ *		A pointer to the elements to push.
+ * @param n
+ *		The number of elements to push.
+ * @param behavior
+ *		Same as ring_push.
+ * @return
+ *		Number of elements pushed.
+ */
+RING_API unsigned ring_bcast_push(struct ring_bcast *b, const void *objs, unsigned n, int behavior);
+
+
+/**
+ * Pop several elements of a broadcast ring for a reader, one thread
+ * per reader.
+ *
+ * @param b
+ *		A pointer to the broadcast ring structure.
+ * @param reader
+ *		The reader, 0 to readers - 1.
+ * @param objs
+ *		A pointer to the elements that will be filled.
+ * @param n
+ *		The number of elements to pop.
+ * @param behavior
+ *		Same as ring_pop.
+ * @return
+ *		Number of elements poped.
+ */
+RING_API unsigned ring_bcast_pop(struct ring_bcast *b, unsigned reader, void *objs, unsigned n, int behavior);
+
+
+/**
+ * Return the number of elements a reader has not popped yet.
+ */
+RING_API unsigned ring_bcast_count(const struct ring_bcast *b, unsigned reader);
+
+
+/**
+ * Create a dynamic ring of esize bytes elements, a single producer and
+ * single consumer ring made of linked segments. A full segment links a
+ * segment of double size, up to max. A segment lightly used for two
+ * rounds links one of half size, down to min. The consumer drains the
+ * old segment before it switches, and frees it.
+ *
+ * @param min
+ *		The number of elements of the first and smallest segment (must be power of 2).
+ * @param max
+ *		The number of elements of the biggest segment (must be power of 2).
+ * @param esize
+ *		The size of ring element, in bytes (must be multiple of 4).
+ * @return
+ *		The pointer to the dynamic ring, NULL if the sizes are invalid
+ *		or out of memory.
+ */
+RING_API struct ring_dyn *ring_dyn_create(unsigned min, unsigned max, unsigned esize);
+
+
+/**
+ * Free a dynamic ring and all its segments.
+ */
+RING_API void ring_dyn_free(struct ring_dyn *d);
+
+
+/**
+ * Push several elements on a dynamic ring, grow it if full.
+ *
+ * @param d
+ *		A pointer to the dynamic ring.
+ * @param objs
+ *		A pointer to the elements to push.
+ * @param n
+ *		The number of elements to push.
+ * @param behavior
+ *		Same as ring_push.
+ * @return
+ *		Number of elements pushed, less than n only if the ring is at
+ *		max size and full, or out of memory.
+ */
+RING_API unsigned ring_dyn_push(struct ring_dyn *d, const void *objs, unsigned n, int behavior);
+
+
+/**
+ * Pop several elements of a dynamic ring, across segments if needed.
+ *
+ * @param d
+ *		A pointer to the dynamic ring.
+ * @param objs
+ *		A pointer to the elements that will be filled.
+ * @param n
+ *		The number of elements to pop.
+ * @param behavior
+ *		Same as ring_pop.
+ * @return
+ *		Number of elements poped.
+ */
+RING_API unsigned ring_dyn_pop(struct ring_dyn *d, void *objs, unsigned n, int behavior);
+
+
+/**
+ * Return the number of elements of the segment the producer pushes on.
+ */
+RING_API unsigned ring_dyn_size(const struct ring_dyn *d);
+
+
+/**
+ * Calculate the memory size needed for a message ring, a ring of
+ * variable length records. Each record is an 8 bytes header (length)
+ * and the payload rounded up to 8 bytes, a record never wraps around
+ * the ring end, the end is filled with a padding record instead.
+ *
+ * @param bytes
+ *		The size of the ring data area in bytes (must be power of 2, 16 or more).
+ * @return
+ *		The memory size needed for the ring on success, or 0 if bytes is invalid.
+ */
+RING_API size_t ring_msg_memsize(unsigned bytes);
+
+
+/**
+ * Initialize a message ring, single or multi producer and always single
+ * consumer, RTS/HTS sync is not used.
+ *
+ * @param r
+ *		The pointer to the ring structure.
+ * @param bytes
+ *		The size of the ring data area in bytes, same as ring_msg_memsize.
+ * @param flags
+ *		RING_F_SP and RING_F_WAIT of ring_init, others are ignored.
+ * @return
+ *		no return.
+ */
+RING_API void ring_msg_init(struct ring *r, unsigned bytes, unsigned flags);
+
+
+/**
+ * Reserve a record of len bytes to be written in place. Each producer
+ * thread has one reservation at most, single producer may have more,
+ * and commits them in order.
+ *
+ * @param r
+ *		A pointer to the message ring.
+ * @param len
+ *		The length of the record, at most bytes / 2 - 8 of the ring.
+ * @return
+ *		The pointer to the 8 bytes aligned record payload,
+ *		or NULL if there is no room or len is too big.
+ */
+RING_API void *ring_msg_reserve(struct ring *r, unsigned len);
+
+
+/**
+ * Publish a record reserved by ring_msg_reserve to the consumer, then
+ * multi producer waits for the previous reservations to commit first.
+ *
+ * @param r
+ *		A pointer to the message ring.
+ * @param msg
+ *		The pointer returned by ring_msg_reserve.
+ * @return
+ *		no return.
+ */
+RING_API void ring_msg_commit(struct ring *r, void *msg);
+
+
+/**
+ * Read the oldest record of a message ring in place, it stays in the
+ * ring until ring_msg_release, reading again returns the same record.
+ *
+ * @param r
+ *		A pointer to the message ring.
+ * @param len
+ *		A pointer to the length of the record that will be filled.
+ * @return
+ *		The pointer to the record payload, or NULL if the ring is empty.
+ */
+RING_API const void *ring_msg_read(struct ring *r, unsigned *len);
+
+
+/**
+ * Release the record returned by the last ring_msg_read.
+ *
+ * @param r
+ *		A pointer to the message ring.
+ * @return
+ *		no return.
+ */
+RING_API void ring_msg_release(struct ring *r);
+
+
+struct ring_mempool;
+
+/**
+ * Per thread LIFO cache of a ring_mempool, owned by one thread, most
+ * get/put hit it only. Refilled from and flushed to the pool ring in
+ * bulk, the cache holds up to 2 * size objects.
+ */
+struct ring_mempool_cache {
+	unsigned size;		/* Objects kept after a refill or flush. */
+	unsigned len;		/* Objects in the cache. */
+	void *objs[RING_MEMPOOL_CACHE_MAX * 2];
+};
+
+/**
+ * Create a pool of n preallocated objects of obj_size bytes, free
+ * objects are kept in a ring of exactly n pointers.
+ *
+ * @param n
+ *		The number of objects (any value).
+ * @param obj_size
+ *		The size of an object in bytes, rounded up to 8 bytes.
+ * @param flags
+ *		Same as ring_init for the pool ring, RING_F_EXACT_SZ is implied.
+ * @return
+ *		The pointer to the pool, NULL if n or obj_size is 0 or out of memory.
+ */
+RING_API struct ring_mempool *ring_mempool_create(unsigned n, unsigned obj_size, unsigned flags);
+
+
+/**
+ * Free a pool and all its objects.
+ */
+RING_API void ring_mempool_free(struct ring_mempool *mp);
+
+
+/**
+ * Initialize a per thread cache of a pool.
+ *
+ * @param c
+ *		The pointer to the cache.
+ * @param size
+ *		The objects kept in the cache (at most RING_MEMPOOL_CACHE_MAX), 0 for no cache.
+ * @return
+ *		no return.
+ */
+RING_API void ring_mempool_cache_init(struct ring_mempool_cache *c, unsigned size);
+
+
+/**
+ * Return all objects of a cache to the pool, before the thread exits.
+ */
+RING_API void ring_mempool_cache_flush(struct ring_mempool *mp, struct ring_mempool_cache *c);
+
+
+/**
+ * Get n objects of a pool, the objects from the pool ring are
+ * prefetched for write.
+ *
+ * @param mp
+ *		A pointer to the pool.
+ * @param c
+ *		The cache of the calling thread, or NULL.
+ * @param objs
+ *		A pointer to an array of void * pointers that will be filled.
+ * @param n
+ *		The number of objects.
+ * @return
+ *		n on success, 0 if there are not n free objects.
+ */
+RING_API unsigned ring_mempool_get(struct ring_mempool *mp, struct ring_mempool_cache *c, void **objs, unsigned n);
+
+
+/**
+ * Put n objects back to a pool.
+ *
+ * @param mp
+ *		A pointer to the pool.
+ * @param c
+ *		The cache of the calling thread, or NULL.
+ * @param objs
+ *		A pointer to an array of objects got from the pool.
+ * @param n
+ *		The number of objects.
+ * @return
+ *		no return.
+ */
+RING_API void ring_mempool_put(struct ring_mempool *mp, struct ring_mempool_cache *c, void * const *objs, unsigned n);
+
+
+/**
+ * Return the number of free objects in the pool ring, objects in the
+ * thread caches are not counted.
+ */
+RING_API unsigned ring_mempool_avail(const struct ring_mempool *mp);
+
+
+/**
+ * Calculate the memory size needed for a work stealing deque (Chase-Lev),
+ * the owner thread pushes and pops objects at the bottom without CAS,
+ * other threads steal the oldest ones at the top.
+ *
+ * @param count
+ *		The number of slots of the deque (must be power of 2).
+ * @return
+ *		The memory size needed for the deque, or 0 if count is invalid.
+ */
+RING_API size_t ring_deque_memsize(unsigned count);
+
+
+/**
+ * Initialize a work stealing deque.
+ *
+ * @param d
+ *		The pointer to the deque structure.
+ * @param count
+ *		The number of slots of the deque.
+ * @return
+ *		no return.
+ */
+RING_API void ring_deque_init(struct ring_deque *d, unsigned count);
+
+
+/**
+ * Push one object at the bottom of a deque, owner only.
+ *
+ * @param d
+ *		A pointer to the deque structure.
+ * @param obj
+ *		The object to push, not NULL.
+ * @return
+ *		1 if pushed, 0 if the deque is full.
+ */
+RING_API int ring_deque_push(struct ring_deque *d, void *obj);
+
+
+/**
+ * Pop the newest object at the bottom of a deque, owner only. A CAS
+ * is only needed when a thief may race for the last object.
+ *
+ * @param d
+ *		A pointer to the deque structure.
+ * @return
+ *		The object, NULL if the deque is empty or the last one was stolen.
+ */
+RING_API void *ring_deque_pop(struct ring_deque *d);
+
+
+/**
+ * Steal the oldest object at the top of a deque, any thread.
+ *
+ * @param d
+ *		A pointer to the deque structure.
+ * @return
+ *		The object, NULL if the deque is empty or another thread won it.
+ */
+RING_API void *ring_deque_steal(struct ring_deque *d);
+
+
+/**
+ * Steal up to half of the objects of a victim deque, oldest first, and
+ * push them to a ring in one burst, e.g. the ring feeding the thief.
+ * The calling thread must be the only producer of r.
+ *
+ * @param d
+ *		A pointer to the victim deque.
+ * @param r
+ *		A pointer to the ring that will be filled.
+ * @return
+ *		Number of objects moved, at most RING_DEQUE_STEAL_MAX.
+ */
+RING_API unsigned ring_deque_steal_half(struct ring_deque *d, struct ring *r);
+
+
+/**
+ * Return the number of objects in a deque, may be stale.
+ */
+RING_API unsigned ring_deque_count(const struct ring_deque *d);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ring_h_
+
+
+#ifdef RING_IMPLEMENTATION
+
+/**
+ * Implement
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <inttypes.h>
+#include <sched.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <linux/magic.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <stddef.h>
+#ifndef offsetof
+#define offsetof(s,m) __builtin_offsetof(s,m)
+#endif
+
+#ifndef likely
+#define likely(x) __builtin_expect((x),1)
+#endif
+
+#ifndef unlikely
+#define unlikely(x) __builtin_expect((x),0)
+#endif
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define cache_aligned __attribute__((__aligned__(CACHE_LINE_SIZE)))
+#define ring_padded __attribute__((__aligned__(RING_CACHE_PAD)))
+
+#if (RING_CACHE_PAD < CACHE_LINE_SIZE) || ((RING_CACHE_PAD) & (RING_CACHE_PAD - 1))
+#error "RING_CACHE_PAD must be a power of 2 of at least CACHE_LINE_SIZE"
+#endif
+
+#define compiler_barrier() do { \
+	asm volatile("":::"memory"); \
+} while (0)
+
+/* True if x is power of 2. */
+#define POWEROF2(x) ((((x)-1) & (x)) == 0)
+
+/**
+ * Memory ordering of ring index accesses. The opposite side tail is loaded
+ * with acquire and the own tail is published with release, so the slot copy
+ * is ordered with the index update on weakly ordered CPUs (e.g. aarch64)
+ * without full fences, x86 compiles them to plain moves.
+ */
+#define LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELAXED(p,v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define STORE_RELEASE(p,v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#if defined(__SANITIZE_THREAD__)
+#define RING_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define RING_TSAN 1
+#endif
+#endif
+
+/* Compare and swap, o is updated to the current value on failure. */
+#define CAS(p,o,n) __atomic_compare_exchange_n((p), &(o), (n), 0, \
+	__ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+/* Cpu relax hint used in spin loops, none for RING_MODEL_CHECK (no asm). */
+static inline void
+ring_pause(void) {
+#if defined(RING_MODEL_CHECK)
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) && defined(RING_PAUSE_ISB)
+	asm volatile("isb" ::: "memory");
+#elif defined(__aarch64__) || defined(__arm__)
+	asm volatile("yield" ::: "memory");
+#else
+	compiler_barrier();
+#endif
+}
+
+#ifndef always_inline
+#define always_inline inline __attribute__((always_inline))
+#endif
+
+/* Sync type of producer or consumer head/tail update. */
+#define RING_SYNC_MT 0		/* Multi thread, wait for previous tail update. */
+#define RING_SYNC_ST 1		/* Single thread. */
+#define RING_SYNC_MT_RTS 2	/* Multi thread, relaxed tail sync. */
+#define RING_SYNC_MT_HTS 3	/* Multi thread, head/tail sync. */
+
+#ifdef RING_STATS
+/* Push or pop counters of a stats slot. */
+struct ring_stat {
+	uint64_t ok;
+	uint64_t fail;
+	uint64_t objs;
+	uint64_t retry;
+	uint64_t spin;
+	uint64_t hwm;
+} cache_aligned;
+#endif
+
+/* Head/tail index, free running and masked on access. */
+#ifdef RING_INDEX64
+typedef uint64_t ring_idx_t;
+#else
+typedef uint32_t ring_idx_t;
+#endif
+
+/* RTS position and update counter. */
+union ring_poscnt {
+	uint64_t raw;
+	struct {
+		uint32_t cnt;
+		uint32_t pos;
+	} val;
+};
+
+/* HTS head and tail in one word. */
+union ring_htpos {
+	uint64_t raw;
+	struct {
+		uint32_t head;
+		uint32_t tail;
+	} pos;
+};
+
+/**
+ * Ring producer or consumer struct. The RTS tail position and the HTS
+ * tail share the same offset with tail, so the opposite side always
+ * reads tail whatever sync type is used (RTS/HTS are not used with
+ * RING_INDEX64).
+ */
+struct ring_headtail {
+	uint32_t sync;
+	uint32_t size;
+	uint32_t mask;
+	uint32_t esize;
+	uint32_t capacity;	/* Usable slots, size - 1 or count if RING_F_EXACT_SZ. */
+	union {
+		struct {
+			ring_idx_t head;
+			ring_idx_t tail;
+		};
+		union ring_htpos hts;
+		union ring_poscnt rts_tail;
+	};
+	union ring_poscnt rts_head;
+	uint32_t htd_max;	/* RTS max distance between head and tail. */
+	uint32_t notify;	/* Wake the opposite side after tail update. */
+	uint32_t waiters;	/* Threads sleep on tail, and RING_WAIT_ARMED. */
+	uint32_t backoff;	/* RING_BACKOFF_* of the tail wait loops. */
+	uint32_t bo_spin;	/* Pauses before yield or sleep. */
+	uint32_t bo_max;	/* Max pauses of one wait step. */
+	int efd;		/* Eventfd written when armed, -1 if none. */
+	uint32_t shared;	/* Waiters may sleep in other processes. */
+	uint32_t nt;		/* Copy with non-temporal stores. */
+	uint32_t scramble;	/* Line index bits of RING_F_SCRAMBLE, 0 if not. */
+	ring_idx_t cached;	/* Opposite tail seen by a single producer/consumer. */
+#ifdef RING_STATS
+	/* Counters of threads, each slot in its own cache line. */
+	struct ring_stat stats[RING_STATS_SLOTS];
+#endif
+};
+
+struct ring {
+	/* Ring producer struct. */
+	struct ring_headtail prod ring_padded;
+
+	/* Ring consumer struct. */
+	struct ring_headtail cons ring_padded;
+
+#ifdef RING_TRACE
+	/* Sampled latency counts of RING_TRACE, updated by consumers. */
+	uint64_t hist[RING_TRACE_BUCKETS] ring_padded;
+#endif
+
+	/* Memory space of ring data. */
+	void *ring[0] ring_padded;
+};
+
+#ifdef RING_STATS
+static unsigned ring_stats_next;
+static __thread unsigned ring_stats_id;
+
+/* Stats slot of the calling thread. */
+static inline struct ring_stat *
+ring_stat_slot(struct ring_headtail *ht) {
+	unsigned id = ring_stats_id;
+
+	if (unlikely(id == 0)) {
+		id = __atomic_add_fetch(&ring_stats_next, 1, __ATOMIC_RELAXED);
+		ring_stats_id = id;
+	}
+	return &ht->stats[(id - 1) % RING_STATS_SLOTS];
+}
+
+/* The slot is the thread's own, no locked op on the hot path. */
+#define RING_STAT_ADD(ht,f,v) do { \
+	struct ring_stat *st = ring_stat_slot(ht); \
+	STORE_RELAXED(&st->f, LOAD_RELAXED(&st->f) + (v)); \
+} while (0)
+
+#define RING_STAT_MAX(ht,f,v) do { \
+	struct ring_stat *st = ring_stat_slot(ht); \
+	uint64_t val = (v); \
+	if (val > LOAD_RELAXED(&st->f)) \
+		STORE_RELAXED(&st->f, val); \
+} while (0)
+#else
+#define RING_STAT_ADD(ht,f,v) do {} while (0)
+#define RING_STAT_MAX(ht,f,v) do {} while (0)
+#endif
+
+/* Offset of the RING_TRACE tsc array after count slots, 8 bytes aligned. */
+#define RING_TRACE_OFF(count,esize) ((((size_t)(count) * (esize)) + 7) & ~(size_t)7)
+
+/* Number of RING_TRACE tsc samples of count slots. */
+#define RING_TRACE_SLOTS(count) (((size_t)(count) + RING_TRACE_SAMPLE - 1) / RING_TRACE_SAMPLE)
+
+/* Cpu time stamp counter, or monotonic ns if none. */
+static inline uint64_t
+ring_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t t;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r"(t));
+	return t;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Histogram bucket of ticks, exact below 2 << RING_TRACE_SUB_BITS. */
+static inline unsigned
+ring_latency_index(uint64_t v) {
+	unsigned msb;
+
+	if (v < ((uint64_t)1 << RING_TRACE_SUB_BITS))
+		return (unsigned)v;
+	msb = 63 - __builtin_clzll(v);
+	return ((msb - RING_TRACE_SUB_BITS + 1) << RING_TRACE_SUB_BITS)
+		| (unsigned)((v >> (msb - RING_TRACE_SUB_BITS)) & ((1 << RING_TRACE_SUB_BITS) - 1));
+}
+
+/* Align x to next power of 2. */
+static inline uint32_t
+align32_pow2(uint32_t x) {
+	x--;
+	x |= x >> 1;
+	x |= x >> 2;
+	x |= x >> 4;
+	x |= x >> 8;
+	x |= x >> 16;
+
+	return x + 1;
+}
+
+/* Align 64bit x to next power of 2. */
+static inline uint64_t
+align64_pow2(uint64_t x) {
+	x--;
+	x |= x >> 1;
+	x |= x >> 2;
+	x |= x >> 4;
+	x |= x >> 8;
+	x |= x >> 16;
+	x |= x >> 32;
+
+	return x + 1;
+}
+
+RING_API size_t
+ring_elem_memsize(unsigned count, unsigned esize) {
+	size_t sz;
+
+	if ((!POWEROF2(count)) || (count > RING_SIZE_MAX)) {
+		return 0;
+	}
+	if ((esize == 0) || (esize & 0x3)) {
+		return 0;
+	}
+	sz = sizeof(struct ring) + (size_t)count * esize;
+#ifdef RING_TRACE
+	sz = RING_TRACE_OFF(count, esize) + RING_TRACE_SLOTS(count) * sizeof(uint64_t)
+		+ sizeof(struct ring);
+#endif
+	return sz;
+}
+
+RING_API size_t
+ring_memsize(unsigned count) {
+	return ring_elem_memsize(count, sizeof(void *));
+}
+
+RING_API size_t
+ring_elem_exact_memsize(unsigned count, unsigned esize) {
+	uint32_t size;
+
+	if ((count == 0) || (count > RING_SIZE_MAX)) {
+		return 0;
+	}
+	/* With 32bit indexes, counts over 2^27 round up past RING_SIZE_MAX. */
+	size = align32_pow2(count);
+	if (size > RING_SIZE_MAX) {
+		return 0;
+	}
+	return ring_elem_memsize(size, esize);
+}
+
+RING_API size_t
+ring_exact_memsize(unsigned count) {
+	return ring_elem_exact_memsize(count, sizeof(void *));
+}
+
+/* Set the indexes of an idle ring, consumers at cons and producers at prod. */
+static void
+ring_set_index(struct ring *r, ring_idx_t cons, ring_idx_t prod) {
+	r->prod.head = r->prod.tail = prod;
+	r->cons.head = r->cons.tail = cons;
+	r->prod.cached = cons;
+	r->cons.cached = prod;
+#ifndef RING_INDEX64
+	/* RTS update counter shares head, the position goes to rts_head. */
+	if (r->prod.sync == RING_SYNC_MT_RTS) {
+		r->prod.rts_tail.val.cnt = r->prod.rts_head.val.cnt = 0;
+		r->prod.rts_head.val.pos = (uint32_t)prod;
+	}
+	if (r->cons.sync == RING_SYNC_MT_RTS) {
+		r->cons.rts_tail.val.cnt = r->cons.rts_head.val.cnt = 0;
+		r->cons.rts_head.val.pos = (uint32_t)cons;
+	}
+#endif
+}
+
+RING_API void
+ring_elem_init(struct ring *r, unsigned count, unsigned esize, unsigned flags) {
+	memset(r, 0, sizeof(*r));
+	if (flags & RING_F_SP)
+		r->prod.sync = RING_SYNC_ST;
+#ifndef RING_INDEX64
+	else if (flags & RING_F_MP_RTS)
+		r->prod.sync = RING_SYNC_MT_RTS;
+	else if (flags & RING_F_MP_HTS)
+		r->prod.sync = RING_SYNC_MT_HTS;
+#endif
+	else
+		r->prod.sync = RING_SYNC_MT;
+	if (flags & RING_F_SC)
+		r->cons.sync = RING_SYNC_ST;
+#ifndef RING_INDEX64
+	else if (flags & RING_F_MC_RTS)
+		r->cons.sync = RING_SYNC_MT_RTS;
+	else if (flags & RING_F_MC_HTS)
+		r->cons.sync = RING_SYNC_MT_HTS;
+#endif
+	else
+		r->cons.sync = RING_SYNC_MT;
+	r->prod.notify = r->cons.notify = !!(flags & RING_F_WAIT);
+	r->prod.nt = !!(flags & RING_F_NT);
+	r->prod.efd = r->cons.efd = -1;
+	if (flags & RING_F_EXACT_SZ) {
+		/* Indexes are free running, so a full power of 2 ring is fine. */
+		r->prod.size = r->cons.size = align32_pow2(count);
+		r->prod.capacity = r->cons.capacity = count;
+	} else {
+		r->prod.size = r->cons.size = count;
+		r->prod.capacity = r->cons.capacity = count - 1;
+	}
+	/* At least 1, so RTS never waits for a given predecessor. */
+	r->prod.htd_max = r->cons.htd_max = (r->prod.capacity + 7) / 8;
+	r->prod.mask = r->cons.mask = r->prod.size - 1;
+	if ((flags & RING_F_SCRAMBLE) && POWEROF2(esize) && esize < CACHE_LINE_SIZE
+		&& r->prod.size >= 2 * (CACHE_LINE_SIZE / esize)) {
+		/* Lines of the data area as bits, at least 1. */
+		r->prod.scramble = r->cons.scramble = __builtin_ctz(r->prod.size)
+			- __builtin_ctz(CACHE_LINE_SIZE / esize);
+	}
+	r->prod.esize = r->cons.esize = esize;
+	ring_set_index(r, (ring_idx_t)RING_INIT_INDEX, (ring_idx_t)RING_INIT_INDEX);
+}
+
+RING_API void
+ring_init(struct ring *r, unsigned count, unsigned flags) {
+	ring_elem_init(r, count, sizeof(void *), flags);
+}
+
+/**
+ * Copy len bytes (multiple of 4) with the widest vector moves of the
+ * build, 64 bytes per loop.
+ */
+static always_inline void
+copy_bulk(uint8_t *d, const uint8_t *s, size_t len) {
+#if defined(__AVX512F__)
+	for (; len >= 64; len -= 64, d += 64, s += 64)
+		_mm512_storeu_si512((void *)d, _mm512_loadu_si512((const void *)s));
+#elif defined(__AVX__)
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)s);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+		_mm256_storeu_si256((__m256i *)d, a);
+		_mm256_storeu_si256((__m256i *)(d + 32), b);
+	}
+#elif defined(__ARM_NEON)
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		uint8x16x4_t v = vld1q_u8_x4(s);
+		vst1q_u8_x4(d, v);
+	}
+#endif
+	for (; len >= 8; len -= 8, d += 8, s += 8)
+		memcpy(d, s, 8);
+	if (len)
+		memcpy(d, s, 4);
+}
+
+/**
+ * Copy len bytes (multiple of 4) to d with non-temporal stores, the
+ * stores are fenced before return so the tail release covers them.
+ */
+static inline void
+copy_stream(uint8_t *d, const uint8_t *s, size_t len) {
+#if defined(__SSE2__)
+	size_t head = (size_t)(-(uintptr_t)d & 63);
+
+	if (head > len)
+		head = len;
+	copy_bulk(d, s, head);
+	d += head, s += head, len -= head;
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+#if defined(__AVX512F__)
+		_mm512_stream_si512((__m512i *)d, _mm512_loadu_si512((const void *)s));
+#elif defined(__AVX__)
+		_mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+		_mm256_stream_si256((__m256i *)(d + 32), _mm256_loadu_si256((const __m256i *)(s + 32)));
+#else
+		_mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+		_mm_stream_si128((__m128i *)(d + 16), _mm_loadu_si128((const __m128i *)(s + 16)));
+		_mm_stream_si128((__m128i *)(d + 32), _mm_loadu_si128((const __m128i *)(s + 32)));
+		_mm_stream_si128((__m128i *)(d + 48), _mm_loadu_si128((const __m128i *)(s + 48)));
+#endif
+	}
+	copy_bulk(d, s, len);
+	_mm_sfence();
+#else
+	copy_bulk(d, s, len);
+#endif
+}
+
+/**
+ * Copy n elements of esize bytes from src to dst. The size switch is
+ * resolved at compile time when esize is a constant, so every case
+ * becomes plain 8/16/32 bytes moves.
+ */
+static always_inline void
+copy_scalar(void *dst, const void *src, unsigned n, uint32_t esize) {
+	uint8_t *d = (uint8_t *)dst;
+	const uint8_t *s = (const uint8_t *)src;
+	unsigned i;
+
+	switch (esize) {
+	case 8:
+		for (i = 0; i < (n & (~(unsigned)0x3)); i+=4, d+=32, s+=32) {
+			memcpy(d, s, 8);
+			memcpy(d+8, s+8, 8);
+			memcpy(d+16, s+16, 8);
+			memcpy(d+24, s+24, 8);
+		}
+		switch (n & 0x3) {
+			case 3: memcpy(d, s, 8); d+=8; s+=8;
+			case 2: memcpy(d, s, 8); d+=8; s+=8;
+			case 1: memcpy(d, s, 8);
+		}
+		break;
+	case 16:
+		for (i = 0; i < (n & (~(unsigned)0x1)); i+=2, d+=32, s+=32) {
+			memcpy(d, s, 16);
+			memcpy(d+16, s+16, 16);
+		}
+		if (n & 0x1)
+			memcpy(d, s, 16);
+		break;
+	case 32:
+		for (i = 0; i < n; i++, d+=32, s+=32)
+			memcpy(d, s, 32);
+		break;
+	default:
+		for (i = 0; i < n * (esize >> 2); i++, d+=4, s+=4)
+			memcpy(d, s, 4);
+		break;
+	}
+}
+
+/* Copy n elements, with vector moves from RING_COPY_SIMD_MIN bytes. */
+static always_inline void
+copy_elems(void *dst, const void *src, unsigned n, uint32_t esize) {
+#if defined(__AVX__) || defined(__ARM_NEON)
+	if ((size_t)n * esize >= RING_COPY_SIMD_MIN) {
+		copy_bulk((uint8_t *)dst, (const uint8_t *)src, (size_t)n * esize);
+		return;
+	}
+#endif
+	copy_scalar(dst, src, n, esize);
+}
+
+/* Copy n elements to the ring, non-temporal if the ring asks for it. */
+static always_inline void
+copy_push(const struct ring *r, void *dst, const void *src, unsigned n, uint32_t esize) {
+	if (unlikely(r->prod.nt) && (size_t)n * esize >= RING_COPY_SIMD_MIN)
+		copy_stream((uint8_t *)dst, (const uint8_t *)src, (size_t)n * esize);
+	else
+		copy_elems(dst, src, n, esize);
+}
+
+#ifdef RING_TRACE
+/* Tsc array of a traced ring, after the data area. */
+static inline uint64_t *
+ring_trace_tsc(const struct ring *r) {
+	return (uint64_t *)((uint8_t *)r->ring + RING_TRACE_OFF(r->prod.size, r->prod.esize));
+}
+
+/* Store the tsc of the sampled slots in [head, head + n). */
+static inline void
+ring_trace_push(struct ring *r, ring_idx_t head, unsigned n) {
+	ring_idx_t i = (head + RING_TRACE_SAMPLE - 1) & ~(ring_idx_t)(RING_TRACE_SAMPLE - 1);
+	uint64_t *tsc, now;
+
+	if (likely((ring_idx_t)(i - head) >= n))
+		return;
+	tsc = ring_trace_tsc(r);
+	now = ring_tsc();
+	for (; (ring_idx_t)(i - head) < n; i += RING_TRACE_SAMPLE)
+		tsc[(i & r->prod.mask) / RING_TRACE_SAMPLE] = now;
+}
+
+/* Count the ticks since push of the sampled slots in [head, head + n). */
+static inline void
+ring_trace_pop(struct ring *r, ring_idx_t head, unsigned n) {
+	ring_idx_t i = (head + RING_TRACE_SAMPLE - 1) & ~(ring_idx_t)(RING_TRACE_SAMPLE - 1);
+	const uint64_t *tsc;
+	uint64_t now;
+
+	if (likely((ring_idx_t)(i - head) >= n))
+		return;
+	tsc = ring_trace_tsc(r);
+	now = ring_tsc();
+	for (; (ring_idx_t)(i - head) < n; i += RING_TRACE_SAMPLE) {
+		uint64_t t = tsc[(i & r->cons.mask) / RING_TRACE_SAMPLE];
+
+		__atomic_fetch_add(&r->hist[ring_latency_index(now > t ? now - t : 0)], 1, __ATOMIC_RELAXED);
+	}
+}
+
+#define RING_TRACE_PUSH(r,h,n) ring_trace_push((r), (h), (n))
+#define RING_TRACE_POP(r,h,n) ring_trace_pop((r), (h), (n))
+#else
+#define RING_TRACE_PUSH(r,h,n) do {} while (0)
+#define RING_TRACE_POP(r,h,n) do {} while (0)
+#endif
+
+/**
+ * Slot of masked index idx in the RING_F_SCRAMBLE layout, the low bits
+ * pick the line and the high bits the slot in the line.
+ */
+static inline uint32_t
+ring_scramble_slot(const struct ring_headtail *ht, uint32_t idx) {
+	const uint32_t bits = ht->scramble;
+
+	return ((idx & ((1u << bits) - 1)) << (__builtin_ctz(ht->size) - bits)) | (idx >> bits);
+}
+
+/* Copy n elements to (push) or from the slots of a RING_F_SCRAMBLE ring. */
+static void
+ring_scramble_copy(struct ring *r, ring_idx_t head, void *objs, unsigned n, uint32_t esize, int push) {
+	/* The geometry of the side copying, pops do not read the producer line. */
+	const struct ring_headtail *ht = push ? &r->prod : &r->cons;
+	uint8_t *ring = (uint8_t *)r->ring;
+	uint8_t *o = (uint8_t *)objs;
+	unsigned i;
+
+	for (i = 0; i < n; i++, o += esize) {
+		uint8_t *slot = ring + (size_t)ring_scramble_slot(ht, (uint32_t)((head + i) & ht->mask)) * esize;
+
+		if (push)
+			copy_scalar(slot, o, 1, esize);
+		else
+			copy_scalar(o, slot, 1, esize);
+	}
+}
+
+#ifdef RING_PREFETCH
+#define RING_PREFETCH_NEXT(p) __builtin_prefetch((p), 0)
+#else
+#define RING_PREFETCH_NEXT(p) do {} while (0)
+#endif
+
+#define PUSH_ELEMS() do { \
+	const uint32_t size = r->prod.size; \
+	uint32_t idx = (uint32_t)(prod_head & r->prod.mask); \
+	uint8_t *ring = (uint8_t *)r->ring; \
+	if (unlikely(r->prod.scramble)) { \
+		ring_scramble_copy(r, prod_head, (void *)objs, n, esize, 1); \
+	} else if (likely(idx + n <= size)) { \
+		copy_push(r, ring + (size_t)idx * esize, objs, n, esize); \
+	} else { \
+		const uint32_t first = size - idx; \
+		copy_push(r, ring + (size_t)idx * esize, objs, first, esize); \
+		copy_push(r, ring, (const uint8_t *)objs + (size_t)first * esize, n - first, esize); \
+	} \
+} while (0)
+
+#define POP_ELEMS() do { \
+	uint32_t idx = (uint32_t)(cons_head & r->cons.mask); \
+	const uint32_t size = r->cons.size; \
+	const uint8_t *ring = (const uint8_t *)r->ring; \
+	if (unlikely(r->cons.scramble)) { \
+		ring_scramble_copy(r, cons_head, objs, n, esize, 0); \
+		break; \
+	} \
+	if (likely(idx + n <= size)) { \
+		copy_elems(objs, ring + (size_t)idx * esize, n, esize); \
+	} else { \
+		const uint32_t first = size - idx; \
+		copy_elems(objs, ring + (size_t)idx * esize, first, esize); \
+		copy_elems((uint8_t *)objs + (size_t)first * esize, ring, n - first, esize); \
+	} \
+	RING_PREFETCH_NEXT(ring + (size_t)((idx + n) & r->cons.mask) * esize); \
+} while (0)
+
+/* Waiters flag bit of an armed eventfd. */
+#define RING_WAIT_ARMED ((uint32_t)1 << 31)
+
+/* Word of tail the waiters sleep on, the low half of a 64bit tail. */
+#if defined(RING_INDEX64) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define RING_TAIL_WORD(ht) ((uint32_t *)&(ht)->tail + 1)
+#else
+#define RING_TAIL_WORD(ht) ((uint32_t *)&(ht)->tail)
+#endif
+
+#ifdef __linux__
+static inline long
+ring_futex(uint32_t *addr, int op, uint32_t val, const struct timespec *ts) {
+	return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+#endif
+
+/* Pause in a spin loop, yield after RING_PAUSE_REP times. */
+static inline void
+ring_spin(int *rep) {
+	ring_pause();
+	if (RING_PAUSE_REP && ++*rep == RING_PAUSE_REP) {
+		*rep = 0;
+		sched_yield();
+	}
+}
+
+/* Pause n times, or tpause as long if WAITPKG. */
+static inline void
+ring_pause_n(uint32_t n) {
+#ifdef __WAITPKG__
+	_tpause(1, __rdtsc() + (uint64_t)n * RING_PAUSE_TSC);
+#else
+	while (n--)
+		ring_pause();
+#endif
+}
+
+/**
+ * Backoff of a tail wait loop by the policy of ht, the caller saw
+ * *word equal to val and waits for it to change. rep counts the
+ * waits of this loop, starts at 0.
+ */
+static void
+ring_backoff(struct ring_headtail *ht, int *rep, uint32_t *word, uint32_t val) {
+	const uint32_t policy = ht->backoff;
+	uint32_t k;
+
+	if (likely(policy == RING_BACKOFF_SPIN)) {
+		ring_spin(rep);
+		return;
+	}
+#ifdef __WAITPKG__
+	if (policy == RING_BACKOFF_UMWAIT) {
+		_umonitor(word);
+		if (LOAD_RELAXED(word) == val)
+			_umwait(1, __rdtsc() + (uint64_t)ht->bo_max * RING_PAUSE_TSC);
+		return;
+	}
+#endif
+	if (policy == RING_BACKOFF_EXP || policy == RING_BACKOFF_UMWAIT) {
+		k = *rep < 31 ? (uint32_t)1 << *rep : ht->bo_max;
+		ring_pause_n(k < ht->bo_max ? k : ht->bo_max);
+		/* Start over after a yield, as RING_BACKOFF_SPIN. */
+		if (*rep < 31)
+			++*rep;
+		if (RING_PAUSE_REP && *rep >= RING_PAUSE_REP) {
+			*rep = 0;
+			sched_yield();
+		}
+		return;
+	}
+	if ((uint32_t)*rep < ht->bo_spin) {
+		++*rep;
+		ring_pause();
+		return;
+	}
+#ifdef __linux__
+	if (policy == RING_BACKOFF_FUTEX) {
+		/* Pairs with the fence of ring_notify after the tail update. */
+		__atomic_add_fetch(&ht->waiters, 1, __ATOMIC_SEQ_CST);
+		ring_futex(word, ht->shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, val, NULL);
+		__atomic_sub_fetch(&ht->waiters, 1, __ATOMIC_RELAXED);
+		return;
+	}
+#endif
+	(void)word;
+	(void)val;
+	sched_yield();
+}
+
+/**
+ * Acquire the tail of the opposite side. RTS/HTS publish it with the
+ * 64bit word it shares, ThreadSanitizer only pairs atomics of the same
+ * address, so it loads the whole word when built with the sanitizer.
+ */
+static always_inline ring_idx_t
+ring_load_tail(const struct ring_headtail *ht) {
+#if defined(RING_TSAN) && !defined(RING_INDEX64)
+	if (ht->sync == RING_SYNC_MT_RTS || ht->sync == RING_SYNC_MT_HTS) {
+		union ring_htpos v;
+
+		v.raw = LOAD_ACQUIRE(&ht->hts.raw);
+		return v.pos.tail;
+	}
+#endif
+	return LOAD_ACQUIRE(&ht->tail);
+}
+
+/**
+ * Move prod.head to reserve n slots for a producer.
+ * Return the number of slots reserved, 0 if none.
+ */
+static always_inline unsigned
+ring_move_prod_head(struct ring *r, int sp, unsigned n, int behavior,
+	ring_idx_t *old_head, ring_idx_t *new_head, uint32_t *free_entries) {
+	ring_idx_t prod_head, prod_next, cons_tail;
+	uint32_t avail;
+	const uint32_t capacity = r->prod.capacity;
+	const unsigned max = n;
+	int ok;
+
+	if (sp) {
+		/*
+		 * A single producer owns prod.head, and checks room against its
+		 * cached cons.tail first, so it only reads the consumer cache line
+		 * when the ring looks too full.
+		 */
+		prod_head = LOAD_RELAXED(&r->prod.head);
+		avail = (uint32_t)(capacity + r->prod.cached - prod_head);
+		if (n > avail) {
+			r->prod.cached = ring_load_tail(&r->cons);
+			avail = (uint32_t)(capacity + r->prod.cached - prod_head);
+		}
+		if (unlikely(n > avail)) {
+			if (behavior == RING_B_FIXED || avail == 0) {
+				*free_entries = avail;
+				return 0;
+			}
+			n = avail;
+		}
+		prod_next = prod_head + n;
+		STORE_RELAXED(&r->prod.head, prod_next);
+		RING_ASSERT(avail <= capacity);
+		RING_STAT_MAX(&r->prod, hwm, capacity - avail + n);
+
+		*old_head = prod_head;
+		*new_head = prod_next;
+		*free_entries = avail - n;
+		return n;
+	}
+
+	do {
+		n = max;
+		/* Acquire head first, so the tail is not older than it. */
+		prod_head = LOAD_ACQUIRE(&r->prod.head);
+		cons_tail = ring_load_tail(&r->cons);
+		avail = (uint32_t)(capacity + cons_tail - prod_head);
+
+		if (unlikely(n > avail)) {
+			if (behavior == RING_B_FIXED) {
+				*free_entries = avail;
+				return 0;
+			} else {
+				if (unlikely(avail == 0)) {
+					*free_entries = avail;
+					return 0;
+				}
+				n = avail;
+			}
+		}
+		prod_next = prod_head + n;
+		ok = CAS(&r->prod.head, prod_head, prod_next);
+		if (unlikely(!ok))
+			RING_STAT_ADD(&r->prod, retry, 1);
+	} while (unlikely(!ok));
+
+	/* Head did not move since the tail was read, so the tail is behind it. */
+	RING_ASSERT(avail <= capacity);
+	RING_STAT_MAX(&r->prod, hwm, capacity - avail + n);
+
+	*old_head = prod_head;
+	*new_head = prod_next;
+	*free_entries = avail - n;
+	return n;
+}
+
+/**
+ * Move cons.head to reserve n entries for a consumer.
+ * Return the number of entries reserved, 0 if none.
+ */
+static always_inline unsigned
+ring_move_cons_head(struct ring *r, int sc, unsigned n, int behavior,
+	ring_idx_t *old_head, ring_idx_t *new_head, uint32_t *entries) {
+	ring_idx_t cons_head, cons_next, prod_tail;
+	uint32_t avail;
+	const unsigned max = n;
+	int ok;
+
+	if (sc) {
+		/* Same as the single producer, with a cached prod.tail. */
+		cons_head = LOAD_RELAXED(&r->cons.head);
+		avail = (uint32_t)(r->cons.cached - cons_head);
+		if (n > avail) {
+			r->cons.cached = ring_load_tail(&r->prod);
+			avail = (uint32_t)(r->cons.cached - cons_head);
+		}
+		if (n > avail) {
+			if (behavior == RING_B_FIXED || unlikely(avail == 0)) {
+				*entries = avail;
+				return 0;
+			}
+			n = avail;
+		}
+		cons_next = cons_head + n;
+		STORE_RELAXED(&r->cons.head, cons_next);
+		RING_ASSERT(avail <= r->cons.capacity);
+		RING_STAT_MAX(&r->cons, hwm, avail);
+
+		*old_head = cons_head;
+		*new_head = cons_next;
+		*entries = avail - n;
+		return n;
+	}
+
+	do {
+		n = max;
+		/* Acquire head first, so the tail is not older than it. */
+		cons_head = LOAD_ACQUIRE(&r->cons.head);
+		prod_tail = ring_load_tail(&r->prod);
+		avail = (uint32_t)(prod_tail - cons_head);
+
+		if (n > avail) {
+			if (behavior == RING_B_FIXED) {
+				*entries = avail;
+				return 0;
+			} else {
+				if (unlikely(avail == 0)) {
+					*entries = avail;
+					return 0;
+				}
+				n = avail;
+			}
+		}
+		cons_next = cons_head + n;
+		ok = CAS(&r->cons.head, cons_head, cons_next);
+		if (unlikely(!ok))
+			RING_STAT_ADD(&r->cons, retry, 1);
+	} while (unlikely(!ok));
+
+	RING_ASSERT(avail <= r->cons.capacity);
+	RING_STAT_MAX(&r->cons, hwm, avail);
+
+	*old_head = cons_head;
+	*new_head = cons_next;
+	*entries = avail - n;
+	return n;
+}
+
+/**
+ * Publish the tail after copy, multi producer/consumer must wait
+ * for the previous ones to finish first.
+ */
+static always_inline void
+ring_update_tail(struct ring_headtail *ht, ring_idx_t old_val, ring_idx_t new_val, int single) {
+	RING_ASSERT((uint32_t)(new_val - old_val) <= ht->capacity);
+	if (!single) {
+		ring_idx_t tail;
+		int rep = 0;
+		/* Acquire the previous one, its copy is published with ours. */
+		while (unlikely((tail = LOAD_ACQUIRE(&ht->tail)) != old_val)) {
+			ring_backoff(ht, &rep, RING_TAIL_WORD(ht), (uint32_t)tail);
+			RING_STAT_ADD(ht, spin, 1);
+		}
+	}
+
+	STORE_RELEASE(&ht->tail, new_val);
+}
+
+/**
+ * RTS move head of d, s is the opposite side and capacity is the
+ * free slots when s tail equals d head. Threads never wait for a given
+ * predecessor, only for the tail not too far away from head.
+ */
+static always_inline unsigned
+ring_rts_move_head(struct ring_headtail *d, const struct ring_headtail *s,
+	uint32_t capacity, unsigned n, int behavior, uint32_t *old_head, uint32_t *entries) {
+	union ring_poscnt oh, nh;
+	uint32_t stail, avail;
+	const unsigned max = n;
+	int rep = 0, ok;
+
+	oh.raw = LOAD_ACQUIRE(&d->rts_head.raw);
+	do {
+		n = max;
+		/* Wait for tail to catch up with head. */
+		while (unlikely(oh.val.pos - (stail = LOAD_ACQUIRE(&d->rts_tail.val.pos)) > d->htd_max)) {
+			ring_backoff(d, &rep, &d->rts_tail.val.pos, stail);
+			RING_STAT_ADD(d, spin, 1);
+			oh.raw = LOAD_ACQUIRE(&d->rts_head.raw);
+		}
+		stail = ring_load_tail(s);
+		avail = capacity + stail - oh.val.pos;
+
+		if (unlikely(n > avail)) {
+			if (behavior == RING_B_FIXED) {
+				*entries = avail;
+				return 0;
+			} else {
+				if (unlikely(avail == 0)) {
+					*entries = avail;
+					return 0;
+				}
+				n = avail;
+			}
+		}
+		nh.val.pos = oh.val.pos + n;
+		nh.val.cnt = oh.val.cnt + 1;
+		ok = __atomic_compare_exchange_n(&d->rts_head.raw, &oh.raw, nh.raw,
+			0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE);
+		if (unlikely(!ok))
+			RING_STAT_ADD(d, retry, 1);
+	} while (unlikely(!ok));
+
+	/* Entries after a push, or before a pop. */
+	RING_STAT_MAX(d, hwm, capacity ? capacity - avail + n : avail);
+
+	*old_head = oh.val.pos;
+	*entries = avail - n;
+	return n;
+}
+
+/**
+ * RTS update tail, each thread increases the tail counter and the
+ * last one which finished moves tail position to head.
+ */
+static always_inline void
+ring_rts_update_tail(struct ring_headtail *ht) {
+	union ring_poscnt h, ot, nt;
+
+	ot.raw = LOAD_ACQUIRE(&ht->rts_tail.raw);
+	do {
+		h.raw = LOAD_RELAXED(&ht->rts_head.raw);
+		nt.raw = ot.raw;
+		if (++nt.val.cnt == h.val.cnt)
+			nt.val.pos = h.val.pos;
+	} while (unlikely(!__atomic_compare_exchange_n(&ht->rts_tail.raw, &ot.raw, nt.raw,
+		0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)));
+}
+
+/**
+ * HTS move head of d, wait until the previous head/tail update finished,
+ * then move head and tail stays, so only one thread is in between.
+ */
+static always_inline unsigned
+ring_hts_move_head(struct ring_headtail *d, const struct ring_headtail *s,
+	uint32_t capacity, unsigned n, int behavior, uint32_t *old_head, uint32_t *entries) {
+	union ring_htpos op, np;
+	uint32_t stail, avail;
+	const unsigned max = n;
+	int rep = 0, ok;
+
+	op.raw = LOAD_ACQUIRE(&d->hts.raw);
+	do {
+		n = max;
+		while (unlikely(op.pos.head != op.pos.tail)) {
+			ring_backoff(d, &rep, &d->hts.pos.tail, op.pos.tail);
+			RING_STAT_ADD(d, spin, 1);
+			op.raw = LOAD_ACQUIRE(&d->hts.raw);
+		}
+		stail = ring_load_tail(s);
+		avail = capacity + stail - op.pos.head;
+
+		if (unlikely(n > avail)) {
+			if (behavior == RING_B_FIXED) {
+				*entries = avail;
+				return 0;
+			} else {
+				if (unlikely(avail == 0)) {
+					*entries = avail;
+					return 0;
+				}
+				n = avail;
+			}
+		}
+		np.pos.tail = op.pos.tail;
+		np.pos.head = op.pos.head + n;
+		ok = __atomic_compare_exchange_n(&d->hts.raw, &op.raw, np.raw,
+			0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE);
+		if (unlikely(!ok))
+			RING_STAT_ADD(d, retry, 1);
+	} while (unlikely(!ok));
+
+	/* Entries after a push, or before a pop. */
+	RING_STAT_MAX(d, hwm, capacity ? capacity - avail + n : avail);
+
+	*old_head = op.pos.head;
+	*entries = avail - n;
+	return n;
+}
+
+/* HTS update tail, the only thread between head and tail. */
+static always_inline void
+ring_hts_update_tail(struct ring_headtail *ht, uint32_t old_tail, unsigned n) {
+	union ring_htpos np;
+
+	np.pos.head = np.pos.tail = old_tail + n;
+	STORE_RELEASE(&ht->hts.raw, np.raw);
+}
+
+/* Slow path of ring_notify, wake the sleeping threads and armed eventfd. */
+static void
+ring_wake(struct ring_headtail *ht) {
+	uint32_t w = LOAD_RELAXED(&ht->waiters);
+
+	if ((w & RING_WAIT_ARMED) && (ht->efd >= 0)) {
+		if (__atomic_fetch_and(&ht->waiters, ~RING_WAIT_ARMED, __ATOMIC_RELAXED) & RING_WAIT_ARMED) {
+			uint64_t one = 1;
+			ssize_t rc = write(ht->efd, &one, sizeof(one));
+			(void)rc;
+		}
+	}
+#ifdef __linux__
+	if (w & ~RING_WAIT_ARMED) {
+		ring_futex(RING_TAIL_WORD(ht), ht->shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+	}
+#endif
+}
+
+/**
+ * Notify the opposite side after tail update. The full fence orders the
+ * tail store before the waiters load, waiters pair it with the seq_cst
+ * waiters update before they recheck and sleep on tail.
+ */
+static always_inline void
+ring_notify(struct ring_headtail *ht) {
+	if (likely(!ht->notify)) {
+		return;
+	}
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (unlikely(LOAD_RELAXED(&ht->waiters))) {
+		ring_wake(ht);
+	}
+}
+
+/* Push on the ring with the producer sync type. */
+static always_inline unsigned
+ring_do_push(struct ring *r, const void *objs, uint32_t esize, unsigned n, int behavior,
+	unsigned *free_space) {
+	ring_idx_t prod_head, prod_next;
+
+	switch (r->prod.sync) {
+	case RING_SYNC_ST:
+		n = ring_move_prod_head(r, 1, n, behavior, &prod_head, &prod_next, free_space);
+		if (unlikely(n == 0))
+			break;
+		PUSH_ELEMS();
+		RING_TRACE_PUSH(r, prod_head, n);
+		ring_update_tail(&r->prod, prod_head, prod_next, 1);
+		break;
+	case RING_SYNC_MT:
+		n = ring_move_prod_head(r, 0, n, behavior, &prod_head, &prod_next, free_space);
+		if (unlikely(n == 0))
+			break;
+		PUSH_ELEMS();
+		RING_TRACE_PUSH(r, prod_head, n);
+		ring_update_tail(&r->prod, prod_head, prod_next, 0);
+		break;
+#ifndef RING_INDEX64
+	case RING_SYNC_MT_RTS:
+		n = ring_rts_move_head(&r->prod, &r->cons, r->prod.capacity, n, behavior, &prod_head, free_space);
+		if (unlikely(n == 0))
+			break;
+		PUSH_ELEMS();
+		RING_TRACE_PUSH(r, prod_head, n);
+		ring_rts_update_tail(&r->prod);
+		break;
+	case RING_SYNC_MT_HTS:
+		n = ring_hts_move_head(&r->prod, &r->cons, r->prod.capacity, n, behavior, &prod_head, free_space);
+		if (unlikely(n == 0))
+			break;
+		PUSH_ELEMS();
+		RING_TRACE_PUSH(r, prod_head, n);
+		ring_hts_update_tail(&r->prod, prod_head, n);
+		break;
+#endif
+	default:
+		return 0;
+	}
+	if (unlikely(n == 0)) {
+		RING_STAT_ADD(&r->prod, fail, 1);
+		return 0;
+	}
+	RING_STAT_ADD(&r->prod, ok, 1);
+	RING_STAT_ADD(&r->prod, objs, n);
+	ring_notify(&r->prod);
+	return n;
+}
+
+/* Pop from the ring with the consumer sync type. */
+static always_inline unsigned
+ring_do_pop(struct ring *r, void *objs, uint32_t esize, unsigned n, int behavior,
+	unsigned *available) {
+	ring_idx_t cons_head, cons_next;
+
+	switch (r->cons.sync) {
+	case RING_SYNC_ST:
+		n = ring_move_cons_head(r, 1, n, behavior, &cons_head, &cons_next, available);
+		if (unlikely(n == 0))
+			break;
+		POP_ELEMS();
+		RING_TRACE_POP(r, cons_head, n);
+		ring_update_tail(&r->cons, cons_head, cons_next, 1);
+		break;
+	case RING_SYNC_MT:
+		n = ring_move_cons_head(r, 0, n, behavior, &cons_head, &cons_next, available);
+		if (unlikely(n == 0))
+			break;
+		POP_ELEMS();
+		RING_TRACE_POP(r, cons_head, n);
+		ring_update_tail(&r->cons, cons_head, cons_next, 0);
+		break;
+#ifndef RING_INDEX64
+	case RING_SYNC_MT_RTS:
+		n = ring_rts_move_head(&r->cons, &r->prod, 0, n, behavior, &cons_head, available);
+		if (unlikely(n == 0))
+			break;
+		POP_ELEMS();
+		RING_TRACE_POP(r, cons_head, n);
+		ring_rts_update_tail(&r->cons);
+		break;
+	case RING_SYNC_MT_HTS:
+		n = ring_hts_move_head(&r->cons, &r->prod, 0, n, behavior, &cons_head, available);
+		if (unlikely(n == 0))
+			break;
+		POP_ELEMS();
+		RING_TRACE_POP(r, cons_head, n);
+		ring_hts_update_tail(&r->cons, cons_head, n);
+		break;
+#endif
+	default:
+		return 0;
+	}
+	if (unlikely(n == 0)) {
+		RING_STAT_ADD(&r->cons, fail, 1);
+		return 0;
+	}
+	RING_STAT_ADD(&r->cons, ok, 1);
+	RING_STAT_ADD(&r->cons, objs, n);
+	ring_notify(&r->cons);
+	return n;
+}
+
+RING_API unsigned
+ring_push(struct ring *r, void * const *objs, unsigned n, int behavior) {
+	unsigned free_space;
+	return ring_do_push(r, objs, sizeof(void *), n, behavior, &free_space);
+}
+
+RING_API unsigned
+ring_elem_push(struct ring *r, const void *objs, unsigned n, int behavior) {
+	unsigned free_space;
+	return ring_do_push(r, objs, r->prod.esize, n, behavior, &free_space);
+}
+
+RING_API unsigned
+ring_pop(struct ring *r, void **objs, unsigned n, int behavior) {
+	unsigned available;
+	return ring_do_pop(r, objs, sizeof(void *), n, behavior, &available);
+}
+
+RING_API unsigned
+ring_elem_pop(struct ring *r, void *objs, unsigned n, int behavior) {
+	unsigned available;
+	return ring_do_pop(r, objs, r->cons.esize, n, behavior, &available);
+}
+
+RING_API unsigned
+ring_push_burst(struct ring *r, void * const *objs, unsigned n, unsigned *free_space) {
+	return ring_do_push(r, objs, sizeof(void *), n, RING_B_VARIABLE, free_space);
+}
+
+RING_API unsigned
+ring_elem_push_burst(struct ring *r, const void *objs, unsigned n, unsigned *free_space) {
+	return ring_do_push(r, objs, r->prod.esize, n, RING_B_VARIABLE, free_space);
+}
+
+RING_API unsigned
+ring_pop_burst(struct ring *r, void **objs, unsigned n, unsigned *available) {
+	return ring_do_pop(r, objs, sizeof(void *), n, RING_B_VARIABLE, available);
+}
+
+RING_API unsigned
+ring_pop_prefetch(struct ring *r, void **objs, unsigned n, int behavior) {
+	unsigned available, i;
+
+	n = ring_do_pop(r, objs, sizeof(void *), n, behavior, &available);
+	for (i = 0; i < n; i++)
+		__builtin_prefetch(objs[i], 0);
+	return n;
+}
+
+RING_API unsigned
+ring_elem_pop_burst(struct ring *r, void *objs, unsigned n, unsigned *available) {
+	return ring_do_pop(r, objs, r->cons.esize, n, RING_B_VARIABLE, available);
+}
+
+/* Fill the zero copy spans of n slots start from head. */
+static inline void
+ring_zc_spans(const struct ring *r, const struct ring_headtail *ht, ring_idx_t head, unsigned n,
+	struct ring_zc_data *zcd) {
+	const uint32_t size = ht->size;
+	const uint32_t esize = ht->esize;
+	const uint32_t idx = (uint32_t)(head & ht->mask);
+	uint8_t *ring = (uint8_t *)r->ring;
+
+	zcd->ptr1 = ring + (size_t)idx * esize;
+	if (likely(idx + n <= size)) {
+		zcd->n1 = n;
+		zcd->ptr2 = NULL;
+	} else {
+		zcd->n1 = size - idx;
+		zcd->ptr2 = ring;
+	}
+}
+
+RING_API unsigned
+ring_push_start(struct ring *r, unsigned n, int behavior, struct ring_zc_data *zcd) {
+	ring_idx_t prod_head, prod_next;
+	uint32_t free_space;
+
+	if (unlikely(r->prod.scramble))
+		return 0;
+	switch (r->prod.sync) {
+	case RING_SYNC_ST:
+		n = ring_move_prod_head(r, 1, n, behavior, &prod_head, &prod_next, &free_space);
+		break;
+#ifndef RING_INDEX64
+	case RING_SYNC_MT_HTS:
+		n = ring_hts_move_head(&r->prod, &r->cons, r->prod.capacity, n, behavior, &prod_head, &free_space);
+		break;
+#endif
+	default:
+		return 0;
+	}
+	if (unlikely(n == 0)) {
+		RING_STAT_ADD(&r->prod, fail, 1);
+		return 0;
+	}
+	ring_zc_spans(r, &r->prod, prod_head, n, zcd);
+	return n;
+}
+
+/**
+ * Finish a zero copy reservation of ht, only one thread is between head
+ * and tail (single or HTS). Publish tail n past it and give back the
+ * reserved slots after.
+ */
+static always_inline void
+ring_zc_finish(struct ring_headtail *ht, ring_idx_t tail, unsigned n) {
+	RING_ASSERT(n <= (uint32_t)(LOAD_RELAXED(&ht->head) - tail));
+#ifndef RING_INDEX64
+	if (ht->sync == RING_SYNC_MT_HTS) {
+		ring_hts_update_tail(ht, (uint32_t)tail, n);
+		return;
+	}
+#endif
+	STORE_RELAXED(&ht->head, tail + n);
+	ring_update_tail(ht, tail, tail + n, 1);
+}
+
+RING_API void
+ring_push_finish(struct ring *r, unsigned n) {
+	ring_idx_t tail = LOAD_RELAXED(&r->prod.tail);
+
+	RING_TRACE_PUSH(r, tail, n);
+	ring_zc_finish(&r->prod, tail, n);
+	RING_STAT_ADD(&r->prod, ok, 1);
+	RING_STAT_ADD(&r->prod, objs, n);
+	ring_notify(&r->prod);
+}
+
+RING_API unsigned
+ring_pop_start(struct ring *r, unsigned n, int behavior, struct ring_zc_data *zcd) {
+	ring_idx_t cons_head, cons_next;
+	uint32_t available;
+
+	if (unlikely(r->cons.scramble))
+		return 0;
+	switch (r->cons.sync) {
+	case RING_SYNC_ST:
+		n = ring_move_cons_head(r, 1, n, behavior, &cons_head, &cons_next, &available);
+		break;
+#ifndef RING_INDEX64
+	case RING_SYNC_MT_HTS:
+		n = ring_hts_move_head(&r->cons, &r->prod, 0, n, behavior, &cons_head, &available);
+		break;
+#endif
+	default:
+		return 0;
+	}
+	if (unlikely(n == 0)) {
+		RING_STAT_ADD(&r->cons, fail, 1);
+		return 0;
+	}
+	ring_zc_spans(r, &r->cons, cons_head, n, zcd);
+	return n;
+}
+
+RING_API void
+ring_pop_finish(struct ring *r, unsigned n) {
+	ring_idx_t tail = LOAD_RELAXED(&r->cons.tail);
+
+	RING_TRACE_POP(r, tail, n);
+	ring_zc_finish(&r->cons, tail, n);
+	RING_STAT_ADD(&r->cons, ok, 1);
+	RING_STAT_ADD(&r->cons, objs, n);
+	ring_notify(&r->cons);
+}
+
+/* Copy entries from cons.head of a SC ring without moving it. */
+static always_inline unsigned
+ring_do_peek(struct ring *r, void *objs, uint32_t esize, unsigned n) {
+	ring_idx_t cons_head;
+	uint32_t avail;
+
+	if (unlikely(r->cons.sync != RING_SYNC_ST))
+		return 0;
+	/* Same as ring_move_cons_head of a single consumer. */
+	cons_head = LOAD_RELAXED(&r->cons.head);
+	avail = (uint32_t)(r->cons.cached - cons_head);
+	if (n > avail) {
+		r->cons.cached = ring_load_tail(&r->prod);
+		avail = (uint32_t)(r->cons.cached - cons_head);
+		if (n > avail)
+			n = avail;
+	}
+	if (likely(n > 0))
+		POP_ELEMS();
+	return n;
+}
+
+RING_API unsigned
+ring_peek(struct ring *r, void **objs, unsigned n) {
+	return ring_do_peek(r, objs, sizeof(void *), n);
+}
+
+RING_API unsigned
+ring_elem_peek(struct ring *r, void *objs, unsigned n) {
+	return ring_do_peek(r, objs, r->cons.esize, n);
+}
+
+RING_API void
+ring_pop_commit(struct ring *r, unsigned n) {
+	ring_idx_t cons_head = LOAD_RELAXED(&r->cons.head);
+
+	/* Peeked entries are below the prod.tail cached by ring_peek. */
+	RING_ASSERT(n <= (uint32_t)(r->cons.cached - cons_head));
+	STORE_RELAXED(&r->cons.head, cons_head + n);
+	RING_TRACE_POP(r, cons_head, n);
+	ring_update_tail(&r->cons, cons_head, cons_head + n, 1);
+	RING_STAT_ADD(&r->cons, ok, 1);
+	RING_STAT_ADD(&r->cons, objs, n);
+	ring_notify(&r->cons);
+}
+
+/* Monotonic clock in milliseconds. */
+static inline int64_t
+ring_clock_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Sleep until tail of ht changes from val, or the deadline.
+ * Return 0 if the deadline is reached.
+ */
+static int
+ring_sleep(struct ring_headtail *ht, uint32_t val, int64_t deadline) {
+	int64_t left = 0;
+
+	if (deadline >= 0) {
+		left = deadline - ring_clock_ms();
+		if (left <= 0) {
+			return 0;
+		}
+	}
+#ifdef __linux__
+	if (ht->notify) {
+		struct timespec ts;
+
+		ts.tv_sec = left / 1000;
+		ts.tv_nsec = (left % 1000) * 1000000;
+		ring_futex(RING_TAIL_WORD(ht), ht->shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, val,
+			deadline >= 0 ? &ts : NULL);
+		return 1;
+	}
+#endif
+	(void)val;
+	sched_yield();
+	return 1;
+}
+
+/**
+ * Push (ht is cons) or pop (ht is prod) on the ring, wait on tail of
+ * ht if there is no room or entry.
+ */
+static always_inline unsigned
+ring_do_wait(struct ring *r, struct ring_headtail *ht, void *objs, uint32_t esize,
+	unsigned n, int behavior, int timeout) {
+	const int push = (ht == &r->cons);
+	const int64_t deadline = timeout < 0 ? -1 : ring_clock_ms() + timeout;
+	unsigned ret, left;
+	uint32_t tail;
+	int rep = 0, spin = 0, ok;
+
+	/* Never satisfied, do not wait for it. */
+	if (unlikely(n == 0 || (behavior == RING_B_FIXED && n > ht->capacity)))
+		return 0;
+	for (;;) {
+		ret = push ? ring_do_push(r, objs, esize, n, behavior, &left)
+			: ring_do_pop(r, objs, esize, n, behavior, &left);
+		if (ret || timeout == 0) {
+			return ret;
+		}
+		if (spin < RING_WAIT_SPIN) {
+			spin++;
+			ring_spin(&rep);
+			continue;
+		}
+
+		/* Announce the waiter, then recheck before sleep. */
+		tail = (uint32_t)LOAD_ACQUIRE(&ht->tail);
+		__atomic_add_fetch(&ht->waiters, 1, __ATOMIC_SEQ_CST);
+		ret = push ? ring_do_push(r, objs, esize, n, behavior, &left)
+			: ring_do_pop(r, objs, esize, n, behavior, &left);
+		ok = ret ? 1 : ring_sleep(ht, tail, deadline);
+		__atomic_sub_fetch(&ht->waiters, 1, __ATOMIC_RELAXED);
+		if (ret || !ok) {
+			return ret;
+		}
+	}
+}
+
+RING_API unsigned
+ring_push_wait(struct ring *r, void * const *objs, unsigned n, int behavior, int timeout) {
+	return ring_do_wait(r, &r->cons, (void *)objs, sizeof(void *), n, behavior, timeout);
+}
+
+RING_API unsigned
+ring_pop_wait(struct ring *r, void **objs, unsigned n, int behavior, int timeout) {
+	return ring_do_wait(r, &r->prod, objs, sizeof(void *), n, behavior, timeout);
+}
+
+RING_API unsigned
+ring_elem_push_wait(struct ring *r, const void *objs, unsigned n, int behavior, int timeout) {
+	return ring_do_wait(r, &r->cons, (void *)objs, r->prod.esize, n, behavior, timeout);
+}
+
+RING_API unsigned
+ring_elem_pop_wait(struct ring *r, void *objs, unsigned n, int behavior, int timeout) {
+	return ring_do_wait(r, &r->prod, objs, r->cons.esize, n, behavior, timeout);
+}
+
+RING_API void
+ring_set_eventfd(struct ring *r, int prod_fd, int cons_fd) {
+	r->prod.efd = prod_fd;
+	r->cons.efd = cons_fd;
+	if (prod_fd >= 0)
+		r->prod.notify = 1;
+	if (cons_fd >= 0)
+		r->cons.notify = 1;
+}
+
+RING_API void
+ring_set_backoff(struct ring *r, unsigned policy, unsigned spin, unsigned max) {
+	r->prod.backoff = r->cons.backoff = policy;
+	r->prod.bo_spin = r->cons.bo_spin = spin;
+	r->prod.bo_max = r->cons.bo_max = max ? max : 1;
+	if (policy == RING_BACKOFF_FUTEX)
+		r->prod.notify = r->cons.notify = 1;
+}
+
+RING_API int
+ring_pop_arm(struct ring *r) {
+	__atomic_fetch_or(&r->prod.waiters, RING_WAIT_ARMED, __ATOMIC_SEQ_CST);
+	return !ring_empty(r);
+}
+
+RING_API int
+ring_push_arm(struct ring *r) {
+	__atomic_fetch_or(&r->cons.waiters, RING_WAIT_ARMED, __ATOMIC_SEQ_CST);
+	return !ring_full(r);
+}
+
+#define RING_SHM_MAGIC 0x474e4952	/* "RING" */
+#define RING_SHM_VERSION 2
+
+/* Header in front of a shared memory ring. */
+struct ring_shm {
+	uint32_t magic;		/* Stored last by the creator. */
+	uint32_t version;
+	uint32_t hdr_size;	/* sizeof(struct ring_shm) */
+	uint32_t ring_size;	/* sizeof(struct ring) */
+	uint32_t line_size;	/* CACHE_LINE_SIZE */
+	uint32_t count;
+	uint32_t esize;
+	uint32_t huge;		/* Segment of RING_HUGEPAGE_DIR. */
+	uint64_t len;		/* Mapped length. */
+} ring_padded;
+
+static int
+ring_shm_open(const char *name, int oflag, int huge) {
+	char path[PATH_MAX];
+
+	if (!huge)
+		return shm_open(name, oflag, 0600);
+	while (*name == '/')
+		name++;
+	if (snprintf(path, sizeof(path), "%s/%s", RING_HUGEPAGE_DIR, name) >= (int)sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return open(path, oflag, 0600);
+}
+
+static int
+ring_shm_remove(const char *name, int huge) {
+	char path[PATH_MAX];
+
+	if (!huge)
+		return shm_unlink(name);
+	while (*name == '/')
+		name++;
+	if (snprintf(path, sizeof(path), "%s/%s", RING_HUGEPAGE_DIR, name) >= (int)sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return unlink(path);
+}
+
+/* Create and map a new segment of len bytes, NULL with errno if fail. */
+static void *
+ring_shm_map(const char *name, size_t len, int huge) {
+	void *p = MAP_FAILED;
+	int fd, err;
+
+	fd = ring_shm_open(name, O_RDWR | O_CREAT | O_EXCL, huge);
+	if (fd < 0)
+		return NULL;
+#ifdef __linux__
+	if (huge) {
+		struct statfs sfs;
+
+		/* Not a hugetlbfs mount, e.g. a bare directory: fall back to shm. */
+		if (fstatfs(fd, &sfs) != 0 || sfs.f_type != HUGETLBFS_MAGIC) {
+			close(fd);
+			ring_shm_remove(name, huge);
+			errno = ENOTSUP;
+			return NULL;
+		}
+	}
+#endif
+	if (ftruncate(fd, len) == 0)
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (p == MAP_FAILED) {
+		ring_shm_remove(name, huge);
+		errno = err;
+		return NULL;
+	}
+	return p;
+}
+
+RING_API struct ring *
+ring_elem_create_shm(const char *name, unsigned count, unsigned esize, unsigned flags) {
+	struct ring_shm *shm = NULL;
+	struct ring *r;
+	size_t sz = (flags & RING_F_EXACT_SZ) ? ring_elem_exact_memsize(count, esize)
+		: ring_elem_memsize(count, esize);
+	size_t len = sizeof(struct ring_shm) + sz;
+	int huge = 0;
+
+	if (sz == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (RING_HUGEPAGE_SIZE > 0) {
+		/* Huge pages fail if hugetlbfs is not mounted or has no free pages. */
+		size_t hlen = (len + RING_HUGEPAGE_SIZE - 1) & ~((size_t)RING_HUGEPAGE_SIZE - 1);
+		int fd = shm_open(name, O_RDONLY, 0);
+
+		/* The name is taken in shm, keep one segment per name. */
+		if (fd >= 0) {
+			close(fd);
+			errno = EEXIST;
+			return NULL;
+		}
+		shm = (struct ring_shm *)ring_shm_map(name, hlen, 1);
+		if (shm) {
+			len = hlen;
+			huge = 1;
+		} else if (errno == EEXIST) {
+			return NULL;
+		}
+	}
+	if (!shm) {
+		shm = (struct ring_shm *)ring_shm_map(name, len, 0);
+		if (!shm)
+			return NULL;
+	}
+
+	r = (struct ring *)(shm + 1);
+	ring_elem_init(r, count, esize, flags);
+	r->prod.shared = r->cons.shared = 1;
+	shm->version = RING_SHM_VERSION;
+	shm->hdr_size = sizeof(struct ring_shm);
+	shm->ring_size = sizeof(struct ring);
+	shm->line_size = CACHE_LINE_SIZE;
+	shm->count = count;
+	shm->esize = esize;
+	shm->huge = huge;
+	shm->len = len;
+	/* Publish the ring to attachers. */
+	STORE_RELEASE(&shm->magic, RING_SHM_MAGIC);
+	return r;
+}
+
+RING_API struct ring *
+ring_create_shm(const char *name, unsigned count, unsigned flags) {
+	return ring_elem_create_shm(name, count, sizeof(void *), flags);
+}
+
+RING_API struct ring *
+ring_attach_shm(const char *name) {
+	struct ring_shm *shm;
+	struct ring *r;
+	struct stat st;
+	size_t len;
+	int fd = -1, err;
+
+	if (RING_HUGEPAGE_SIZE > 0)
+		fd = ring_shm_open(name, O_RDWR, 1);
+	if (fd < 0)
+		fd = ring_shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	len = st.st_size;
+	if (len < sizeof(struct ring_shm) + sizeof(struct ring)) {
+		/* The creator has not sized the segment yet. */
+		close(fd);
+		errno = EAGAIN;
+		return NULL;
+	}
+	shm = (struct ring_shm *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (shm == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+
+	r = (struct ring *)(shm + 1);
+	if (LOAD_ACQUIRE(&shm->magic) != RING_SHM_MAGIC) {
+		munmap(shm, len);
+		errno = EAGAIN;
+		return NULL;
+	}
+	if (shm->version != RING_SHM_VERSION
+		|| shm->hdr_size != sizeof(struct ring_shm)
+		|| shm->ring_size != sizeof(struct ring)
+		|| shm->line_size != CACHE_LINE_SIZE
+		|| shm->len != len
+		|| ring_elem_exact_memsize(shm->count, shm->esize) == 0
+		|| sizeof(struct ring_shm) + ring_elem_exact_memsize(shm->count, shm->esize) > len
+		|| r->prod.size != align32_pow2(shm->count) || r->cons.size != r->prod.size
+		|| r->prod.capacity > shm->count || r->cons.capacity != r->prod.capacity
+		|| r->prod.esize != shm->esize || r->cons.esize != shm->esize
+		|| !r->prod.shared || !r->cons.shared) {
+		munmap(shm, len);
+		errno = EPROTO;
+		return NULL;
+	}
+	return r;
+}
+
+RING_API void
+ring_detach_shm(struct ring *r) {
+	struct ring_shm *shm = (struct ring_shm *)r - 1;
+
+	munmap(shm, shm->len);
+}
+
+RING_API int
+ring_unlink_shm(const char *name) {
+	int rc = -1;
+
+	if (RING_HUGEPAGE_SIZE > 0)
+		rc = ring_shm_remove(name, 1);
+	if (rc < 0)
+		rc = ring_shm_remove(name, 0);
+	return rc;
+}
+
+#define RING_SNAP_MAGIC 0x50414e53	/* "SNAP" */
+#define RING_SNAP_VERSION 1
+
+/* Snapshot file header, followed by the slots of the range. */
+struct ring_snap {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t capacity;
+	uint32_t esize;
+	uint32_t scramble;	/* Whole data area follows, slots are not in index order. */
+	uint64_t tail;		/* cons.tail, index of the first element. */
+	uint64_t count;
+};
+
+/* Read or write all of iov, retry on partial transfers and EINTR. */
+static int
+ring_snap_io(int fd, struct iovec *iov, int cnt, int wr) {
+	for (;;) {
+		ssize_t n;
+
+		while (cnt > 0 && iov->iov_len == 0) {
+			iov++;
+			cnt--;
+		}
+		if (cnt == 0)
+			return 0;
+		n = wr ? writev(fd, iov, cnt) : readv(fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+/* Slot spans of count elements from index tail, the whole area if scrambled. */
+static int
+ring_snap_iov(const struct ring *r, ring_idx_t tail, uint32_t count, struct iovec *iov) {
+	uint8_t *ring = (uint8_t *)r->ring;
+	const uint32_t esize = r->prod.esize, size = r->prod.size;
+	uint32_t idx = (uint32_t)(tail & r->prod.mask);
+	int cnt = 0;
+
+	if (r->prod.scramble) {
+		iov[cnt].iov_base = ring;
+		iov[cnt++].iov_len = (size_t)size * esize;
+	} else if (idx + count <= size) {
+		iov[cnt].iov_base = ring + (size_t)idx * esize;
+		iov[cnt++].iov_len = (size_t)count * esize;
+	} else {
+		iov[cnt].iov_base = ring + (size_t)idx * esize;
+		iov[cnt++].iov_len = (size_t)(size - idx) * esize;
+		iov[cnt].iov_base = ring;
+		iov[cnt++].iov_len = (size_t)(count - (size - idx)) * esize;
+	}
+	return cnt;
+}
+
+/* Whether a side has a push or pop between its head and tail moves. */
+static int
+ring_snap_busy(const struct ring_headtail *ht) {
+#ifndef RING_INDEX64
+	if (ht->sync == RING_SYNC_MT_RTS) {
+		union ring_poscnt h, t;
+
+		h.raw = LOAD_ACQUIRE(&ht->rts_head.raw);
+		t.raw = LOAD_ACQUIRE(&ht->rts_tail.raw);
+		return h.val.pos != t.val.pos;
+	}
+	if (ht->sync == RING_SYNC_MT_HTS) {
+		union ring_htpos p;
+
+		p.raw = LOAD_ACQUIRE(&ht->hts.raw);
+		return p.pos.head != p.pos.tail;
+	}
+#endif
+	return LOAD_ACQUIRE(&ht->head) != LOAD_ACQUIRE(&ht->tail);
+}
+
+RING_API int
+ring_snapshot(const struct ring *r, int fd) {
+	struct ring_snap hdr;
+	struct iovec iov[3];
+	ring_idx_t tail = LOAD_ACQUIRE(&r->cons.tail);
+	uint32_t count = (uint32_t)(LOAD_ACQUIRE(&r->prod.tail) - tail);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = RING_SNAP_MAGIC;
+	hdr.version = RING_SNAP_VERSION;
+	hdr.size = r->prod.size;
+	hdr.capacity = r->prod.capacity;
+	hdr.esize = r->prod.esize;
+	hdr.scramble = r->prod.scramble;
+	hdr.tail = tail;
+	hdr.count = count;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	return ring_snap_io(fd, iov, 1 + ring_snap_iov(r, tail, count, iov + 1), 1);
+}
+
+RING_API int
+ring_restore(struct ring *r, int fd) {
+	struct ring_snap hdr;
+	struct iovec iov[2];
+	ring_idx_t tail;
+
+	/* Restoring would drop the elements or race the ones in progress. */
+	if (ring_snap_busy(&r->prod) || ring_snap_busy(&r->cons)
+		|| ring_load_tail(&r->prod) != ring_load_tail(&r->cons)) {
+		errno = EBUSY;
+		return -1;
+	}
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	if (ring_snap_io(fd, iov, 1, 0) < 0)
+		return -1;
+	if (hdr.magic != RING_SNAP_MAGIC || hdr.version != RING_SNAP_VERSION
+		|| hdr.size != r->prod.size || hdr.capacity != r->prod.capacity
+		|| hdr.esize != r->prod.esize || hdr.scramble != r->prod.scramble
+		|| hdr.count > hdr.capacity) {
+		errno = EPROTO;
+		return -1;
+	}
+	tail = (ring_idx_t)hdr.tail;
+	if (ring_snap_io(fd, iov, ring_snap_iov(r, tail, (uint32_t)hdr.count, iov), 0) < 0)
+		return -1;
+	ring_set_index(r, tail, tail + (ring_idx_t)hdr.count);
+	return 0;
+}
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_STRICT
+#define MPOL_MF_STRICT (1 << 0)
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+#ifndef MPOL_F_NODE
+#define MPOL_F_NODE (1 << 0)
+#endif
+#ifndef MPOL_F_ADDR
+#define MPOL_F_ADDR (1 << 1)
+#endif
+
+/* Header in front of a numa ring. */
+struct ring_numa {
+	uint64_t len;		/* Mapped length. */
+	int32_t node;
+} ring_padded;
+
+/* Map len bytes aligned to RING_HUGEPAGE_SIZE, for transparent huge pages. */
+static void *
+ring_numa_map(size_t len) {
+	const size_t align = RING_HUGEPAGE_SIZE;
+	uint8_t *p, *a;
+	size_t head, tail;
+
+	p = (uint8_t *)mmap(NULL, len + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	a = (uint8_t *)(((uintptr_t)p + align - 1) & ~((uintptr_t)align - 1));
+	/* Trim the slack of [p, p + len + align) around [a, a + len). */
+	head = (size_t)(a - p);
+	tail = align - head;
+	if (head)
+		munmap(p, head);
+	if (tail)
+		munmap(a + len, tail);
+#ifdef MADV_HUGEPAGE
+	madvise(a, len, MADV_HUGEPAGE);
+#endif
+	return a;
+}
+
+/* Bind the pages of [p, p + len) to node, 0 on success. */
+static int
+ring_numa_bind(void *p, size_t len, int node) {
+#ifdef __linux__
+	const unsigned bits = 8 * sizeof(unsigned long);
+	unsigned long mask[RING_NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / bits] = 1UL << (node % bits);
+	/* The kernel takes maxnode - 1 bits of the mask. */
+	return (int)syscall(SYS_mbind, p, len, MPOL_BIND, mask, (unsigned long)RING_NUMA_MAX_NODES + 1,
+		MPOL_MF_STRICT | MPOL_MF_MOVE);
+#else
+	(void)p;
+	(void)len;
+	(void)node;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+RING_API struct ring *
+ring_elem_create_numa(unsigned count, unsigned esize, unsigned flags, int node) {
+	struct ring_numa *numa;
+	struct ring *r;
+	size_t sz = (flags & RING_F_EXACT_SZ) ? ring_elem_exact_memsize(count, esize)
+		: ring_elem_memsize(count, esize);
+	size_t len = sizeof(struct ring_numa) + sz;
+
+	if (sz == 0 || node < -1 || node >= RING_NUMA_MAX_NODES) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (RING_HUGEPAGE_SIZE > 0 && len >= RING_HUGEPAGE_SIZE) {
+		len = (len + RING_HUGEPAGE_SIZE - 1) & ~((size_t)RING_HUGEPAGE_SIZE - 1);
+		numa = (struct ring_numa *)ring_numa_map(len);
+	} else {
+		numa = (struct ring_numa *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (numa == MAP_FAILED)
+			numa = NULL;
+	}
+	if (!numa)
+		return NULL;
+	if (node >= 0 && ring_numa_bind(numa, len, node) != 0) {
+		int err = errno;
+
+		munmap(numa, len);
+		errno = err;
+		return NULL;
+	}
+	/* Fault the pages in under the policy, not on the first push. */
+	memset(numa, 0, len);
+	numa->len = len;
+	numa->node = node;
+	r = (struct ring *)(numa + 1);
+	ring_elem_init(r, count, esize, flags);
+	return r;
+}
+
+RING_API struct ring *
+ring_create_numa(unsigned count, unsigned flags, int node) {
+	return ring_elem_create_numa(count, sizeof(void *), flags, node);
+}
+
+RING_API void
+ring_free_numa(struct ring *r) {
+	struct ring_numa *numa = (struct ring_numa *)r - 1;
+
+	munmap(numa, numa->len);
+}
+
+RING_API int
+ring_numa_node(const struct ring *r) {
+#ifdef __linux__
+	int node = -1;
+
+	/* Also faults the page in if it is not touched yet. */
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0UL, (void *)r->ring, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+		return -1;
+	return node;
+#else
+	(void)r;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+RING_API void
+ring_stats_get(const struct ring *r, struct ring_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+#ifdef RING_STATS
+	unsigned i;
+
+	for (i = 0; i < RING_STATS_SLOTS; i++) {
+		const struct ring_stat *p = &r->prod.stats[i];
+		const struct ring_stat *c = &r->cons.stats[i];
+
+		stats->push_ok += LOAD_RELAXED(&p->ok);
+		stats->push_fail += LOAD_RELAXED(&p->fail);
+		stats->push_objs += LOAD_RELAXED(&p->objs);
+		stats->push_retry += LOAD_RELAXED(&p->retry);
+		stats->push_spin += LOAD_RELAXED(&p->spin);
+		stats->pop_ok += LOAD_RELAXED(&c->ok);
+		stats->pop_fail += LOAD_RELAXED(&c->fail);
+		stats->pop_objs += LOAD_RELAXED(&c->objs);
+		stats->pop_retry += LOAD_RELAXED(&c->retry);
+		stats->pop_spin += LOAD_RELAXED(&c->spin);
+		if (LOAD_RELAXED(&p->hwm) > stats->max_count)
+			stats->max_count = LOAD_RELAXED(&p->hwm);
+		if (LOAD_RELAXED(&c->hwm) > stats->max_count)
+			stats->max_count = LOAD_RELAXED(&c->hwm);
+	}
+#else
+	(void)r;
+#endif
+}
+
+RING_API void
+ring_stats_reset(struct ring *r) {
+#ifdef RING_STATS
+	memset(r->prod.stats, 0, sizeof(r->prod.stats));
+	memset(r->cons.stats, 0, sizeof(r->cons.stats));
+#else
+	(void)r;
+#endif
+}
+
+RING_API uint64_t
+ring_latency_histogram(const struct ring *r, uint64_t *buckets) {
+	uint64_t total = 0;
+	unsigned i;
+
+	for (i = 0; i < RING_TRACE_BUCKETS; i++) {
+#ifdef RING_TRACE
+		buckets[i] = LOAD_RELAXED(&r->hist[i]);
+#else
+		buckets[i] = 0;
+#endif
+		total += buckets[i];
+	}
+	(void)r;
+	return total;
+}
+
+RING_API uint64_t
+ring_latency_bucket(unsigned i) {
+	const unsigned sub = 1 << RING_TRACE_SUB_BITS;
+	unsigned msb;
+
+	if (i < sub)
+		return i;
+	if (i >= RING_TRACE_BUCKETS)
+		return UINT64_MAX;
+	msb = (i >> RING_TRACE_SUB_BITS) + RING_TRACE_SUB_BITS - 1;
+	return ((uint64_t)1 << msb) | ((uint64_t)(i & (sub - 1)) << (msb - RING_TRACE_SUB_BITS));
+}
+
+RING_API uint64_t
+ring_latency_percentile(const uint64_t *buckets, double q) {
+	uint64_t total = 0, sum = 0, want;
+	unsigned i;
+
+	for (i = 0; i < RING_TRACE_BUCKETS; i++)
+		total += buckets[i];
+	if (total == 0)
+		return 0;
+	want = (uint64_t)(q * (double)total);
+	for (i = 0; i < RING_TRACE_BUCKETS; i++) {
+		sum += buckets[i];
+		if (sum > want)
+			break;
+	}
+	return ring_latency_bucket(i < RING_TRACE_BUCKETS ? i : RING_TRACE_BUCKETS - 1);
+}
+
+RING_API void
+ring_latency_reset(struct ring *r) {
+#ifdef RING_TRACE
+	memset(r->hist, 0, sizeof(r->hist));
+#else
+	(void)r;
+#endif
+}
+
+RING_API int
+ring_full(const struct ring *r) {
+	ring_idx_t prod_tail = ring_load_tail(&r->prod);
+	ring_idx_t cons_tail = ring_load_tail(&r->cons);
+	return (uint32_t)(prod_tail - cons_tail) >= r->prod.capacity;
+}
+
+RING_API int
+ring_empty(const struct ring *r) {
+	ring_idx_t prod_tail = ring_load_tail(&r->prod);
+	ring_idx_t cons_tail = ring_load_tail(&r->cons);
+	return !!(cons_tail == prod_tail);
+}
+
+RING_API unsigned
+ring_count(const struct ring *r) {
+	ring_idx_t prod_tail = ring_load_tail(&r->prod);
+	ring_idx_t cons_tail = ring_load_tail(&r->cons);
+	uint32_t count = (uint32_t)(prod_tail - cons_tail);
+	return count > r->prod.capacity ? r->prod.capacity : count;
+}
+
+RING_API unsigned
+ring_avail(const struct ring *r) {
+	ring_idx_t prod_tail = ring_load_tail(&r->prod);
+	ring_idx_t cons_tail = ring_load_tail(&r->cons);
+	uint32_t count = (uint32_t)(prod_tail - cons_tail);
+	return count > r->prod.capacity ? 0 : r->prod.capacity - count;
+}
+
+/**
+ * Set bit idx after a push, skip the atomic op if it is already set.
+ * The fence orders the tail store of the push before the bit load,
+ * pairing with the fence of ring_bitmap_clear: either the consumer
+ * sees the push in its recheck, or the load sees the bit cleared.
+ */
+static inline void
+ring_bitmap_set(uint64_t *bits, unsigned idx) {
+	uint64_t bit = (uint64_t)1 << (idx & 63);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!(LOAD_RELAXED(&bits[idx >> 6]) & bit))
+		__atomic_fetch_or(&bits[idx >> 6], bit, __ATOMIC_SEQ_CST);
+}
+
+/* Clear bit idx, fenced before the recheck of the ring that follows. */
+static inline void
+ring_bitmap_clear(uint64_t *bits, unsigned idx) {
+	__atomic_fetch_and(&bits[idx >> 6], ~((uint64_t)1 << (idx & 63)), __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * Return the first set bit at or after from in nbits bits, wrapping
+ * around to 0, -1 if none.
+ */
+static inline int
+ring_bitmap_next(const uint64_t *bits, unsigned nbits, unsigned from) {
+	const unsigned nwords = (nbits + 63) >> 6;
+	unsigned w, i;
+	uint64_t v;
+
+	if (from >= nbits)
+		from = 0;
+	w = from >> 6;
+	v = LOAD_RELAXED(&bits[w]) & (~(uint64_t)0 << (from & 63));
+	/* The first word is loaded again at last for the bits before from. */
+	for (i = 0; i <= nwords; i++) {
+		if (v)
+			return (int)(w * 64 + __builtin_ctzll(v));
+		w = (w + 1 == nwords) ? 0 : w + 1;
+		v = LOAD_RELAXED(&bits[w]);
+	}
+	return -1;
+}
+
+struct ring_set_member {
+	struct ring *r;
+	unsigned weight;	/* Max objects popped in a turn, 0 for no limit. */
+};
+
+struct ring_set {
+	/* Consumer only. */
+	unsigned max;
+	unsigned count;
+	unsigned cursor;	/* Ring to pop first. */
+#ifdef RING_SET_SCAN
+	unsigned polls;		/* Polls since the last full scan. */
+#endif
+	struct ring_set_member *members;
+
+	/* Non-empty bits set by producers, cleared by the consumer. */
+	uint64_t bits[0] ring_padded;
+};
+
+/* Bytes of the bits, padded so the members read by pop are not on their lines. */
+#define RING_SET_BITS_SIZE(max) \
+	((((max) + 63) / 64 * sizeof(uint64_t) + RING_CACHE_PAD - 1) & ~((size_t)RING_CACHE_PAD - 1))
+
+RING_API unsigned
+ring_set_memsize(unsigned max) {
+	if (max == 0)
+		return 0;
+	return sizeof(struct ring_set) + RING_SET_BITS_SIZE(max)
+		+ max * sizeof(struct ring_set_member);
+}
+
+RING_API void
+ring_set_init(struct ring_set *set, unsigned max) {
+	memset(set, 0, ring_set_memsize(max));
+	set->max = max;
+	set->members = (struct ring_set_member *)((uint8_t *)set->bits + RING_SET_BITS_SIZE(max));
+}
+
+RING_API int
+ring_set_add(struct ring_set *set, struct ring *r, unsigned weight) {
+	unsigned idx = set->count;
+
+	if (idx >= set->max)
+		return -1;
+	set->members[idx].r = r;
+	set->members[idx].weight = weight;
+	set->count = idx + 1;
+	if (!ring_empty(r))
+		ring_bitmap_set(set->bits, idx);
+	return (int)idx;
+}
+
+RING_API void
+ring_set_mark(struct ring_set *set, unsigned idx) {
+	ring_bitmap_set(set->bits, idx);
+}
+
+RING_API unsigned
+ring_set_push(struct ring_set *set, unsigned idx, void * const *objs, unsigned n, int behavior) {
+	n = ring_push(set->members[idx].r, objs, n, behavior);
+	if (n > 0)
+		ring_bitmap_set(set->bits, idx);
+	return n;
+}
+
+RING_API unsigned
+ring_set_pop(struct ring_set *set, void **objs, unsigned n) {
+	struct ring_set_member *m;
+	unsigned got = 0, from = set->cursor, turns, want, k, left;
+	int idx;
+
+	for (turns = 0; got < n && turns < set->count; turns++) {
+		idx = ring_bitmap_next(set->bits, set->count, from);
+		if (idx < 0)
+			break;
+		m = &set->members[idx];
+		want = n - got;
+		if (m->weight && want > m->weight)
+			want = m->weight;
+		k = ring_pop_burst(m->r, objs + got, want, &left);
+		got += k;
+		if (left == 0) {
+			/**
+			 * Clear before recheck, a producer pushing now either sees
+			 * the bit clear and sets it, or its push is seen here.
+			 */
+			ring_bitmap_clear(set->bits, idx);
+			if (!ring_empty(m->r))
+				ring_bitmap_set(set->bits, idx);
+		}
+		from = (unsigned)idx + 1;
+	}
+	set->cursor = from;
+
+#ifdef RING_SET_SCAN
+	/* Every RING_SET_SCAN polls, busy or not, for pushes not marked. */
+	if (++set->polls >= RING_SET_SCAN) {
+		set->polls = 0;
+		for (k = 0; k < set->count; k++) {
+			if (!ring_empty(set->members[k].r))
+				ring_bitmap_set(set->bits, k);
+		}
+	}
+#endif
+	return got;
 }
 
-#define PUSH_PTRS() do { \
-	const uint32_t size = r->prod.size; \
-	uint32_t idx = prod_head & mask; \
-	unsigned i; \
-	if (likely(idx + n < size)) { \
-		for (i = 0; i < (n & ((~(unsigned)0x3))); i+=4, idx+=4) { \
-			r->ring[idx] = objs[i]; \
-			r->ring[idx+1] = objs[i+1]; \
-			r->ring[idx+2] = objs[i+2]; \
-			r->ring[idx+3] = objs[i+3]; \
-		} \
-		switch (n & 0x3) { \
-			case 3: r->ring[idx++] = objs[i++]; \
-			case 2: r->ring[idx++] = objs[i++]; \
-			case 1: r->ring[idx++] = objs[i++]; \
-		} \
-	} else { \
-		for (i = 0; idx < size; i++, idx++) \
-		r->ring[idx] = objs[i]; \
-		for (idx = 0; i < n; i++, idx++) \
-		r->ring[idx] = objs[i]; \
-	} \
-} while (0)
+struct ring_prio {
+	/* Consumer only. */
+	unsigned lanes;
+	unsigned cursor;	/* Weighted lane to pop first. */
+	unsigned weights;	/* Number of weighted lanes. */
+	size_t stride;		/* Bytes of a lane ring. */
+	unsigned weight[RING_PRIO_MAX_LANES];
 
-/* Single producer push on the ring. */
-static unsigned
-ring_sp_push(struct ring *r, void * const *objs, unsigned n, int behavior) {
-	uint32_t prod_head, cons_tail;
-	uint32_t prod_next, avail;
-	uint32_t mask = r->prod.mask;
+	/* Non-empty lanes set by producers, cleared by the consumer. */
+	uint64_t bits ring_padded;
+};
 
-	prod_head = r->prod.head;
-	cons_tail = r->cons.tail;
-	avail = mask + cons_tail - prod_head;
+/* Ring of lane i, the lane rings are after the header. */
+#define RING_PRIO_LANE(p,i) ((struct ring *)((uint8_t *)((p) + 1) + (i) * (p)->stride))
 
-	if (unlikely(n > avail)) {
-		if (behavior == RING_B_FIXED) {
-			return 0;
-		} else {
-			if (unlikely(avail == 0)) {
-				return 0;
-			}
-			n = avail;
-		}
+/* Bytes of a lane ring, the same for power of 2 and exact counts. */
+static inline size_t
+ring_prio_stride(unsigned count) {
+	size_t sz = ring_exact_memsize(count);
+
+	return (sz + RING_CACHE_PAD - 1) & ~((size_t)RING_CACHE_PAD - 1);
+}
+
+RING_API size_t
+ring_prio_memsize(unsigned lanes, unsigned count) {
+	size_t sz = ring_prio_stride(count);
+
+	if (lanes == 0 || lanes > RING_PRIO_MAX_LANES || sz == 0)
+		return 0;
+	return sizeof(struct ring_prio) + lanes * sz;
+}
+
+RING_API int
+ring_prio_init(struct ring_prio *p, unsigned lanes, unsigned count, unsigned flags) {
+	unsigned i;
+
+	if (ring_prio_memsize(lanes, count) == 0
+		|| (!POWEROF2(count) && !(flags & RING_F_EXACT_SZ))) {
+		errno = EINVAL;
+		return -1;
 	}
-	prod_next = prod_head + n;
-	r->prod.head = prod_next;
+	memset(p, 0, sizeof(*p));
+	p->lanes = lanes;
+	p->stride = ring_prio_stride(count);
+	for (i = 0; i < lanes; i++)
+		ring_init(RING_PRIO_LANE(p, i), count, flags | RING_F_SC);
+	return 0;
+}
 
-	PUSH_PTRS();
-	compiler_barrier();
+RING_API void
+ring_prio_set_weight(struct ring_prio *p, unsigned lane, unsigned weight) {
+	if (weight && !p->weight[lane])
+		p->weights++;
+	else if (!weight && p->weight[lane])
+		p->weights--;
+	p->weight[lane] = weight;
+}
 
-	r->prod.tail = prod_next;
+RING_API unsigned
+ring_prio_push(struct ring_prio *p, unsigned lane, void * const *objs, unsigned n, int behavior) {
+	n = ring_push(RING_PRIO_LANE(p, lane), objs, n, behavior);
+	if (n > 0)
+		ring_bitmap_set(&p->bits, lane);
 	return n;
 }
 
-/* Multi producer push on the ring. */
-static unsigned
-ring_mp_push(struct ring *r, void * const *objs, unsigned n, int behavior) {
-	uint32_t prod_head, prod_next;
-	uint32_t cons_tail, avail;
-	uint32_t mask = r->prod.mask;
-	const unsigned max = n;
-	int ok;
+/* Pop up to n objects of a lane, clear its bit if it is drained. */
+static inline unsigned
+ring_prio_take(struct ring_prio *p, unsigned lane, void **objs, unsigned n) {
+	struct ring *r = RING_PRIO_LANE(p, lane);
+	unsigned k, left;
 
-	do {
-		n = max;
-		prod_head = r->prod.head;
-		cons_tail = r->cons.tail;
-		avail = mask + cons_tail - prod_head;
+	k = ring_pop_burst(r, objs, n, &left);
+	if (left == 0) {
+		/* Clear before recheck, as ring_set_pop. */
+		ring_bitmap_clear(&p->bits, lane);
+		if (!ring_empty(r))
+			ring_bitmap_set(&p->bits, lane);
+	}
+	return k;
+}
 
-		if (unlikely(n > avail)) {
-			if (behavior == RING_B_FIXED) {
+RING_API unsigned
+ring_prio_pop(struct ring_prio *p, void **objs, unsigned n) {
+	unsigned got = 0, from, turns, want;
+	int idx;
+
+	/* Strict lanes in priority order, no wrap around. */
+	for (from = 0; got < n && from < p->lanes; from = (unsigned)idx + 1) {
+		idx = ring_bitmap_next(&p->bits, p->lanes, from);
+		if (idx < (int)from)
+			break;
+		if (p->weight[idx] == 0)
+			got += ring_prio_take(p, (unsigned)idx, objs + got, n - got);
+	}
+
+	/* Weighted lanes share the rest round robin. */
+	from = p->cursor;
+	for (turns = 0; p->weights && got < n && turns < p->lanes; turns++) {
+		idx = ring_bitmap_next(&p->bits, p->lanes, from);
+		if (idx < 0)
+			break;
+		from = (unsigned)idx + 1;
+		if (p->weight[idx] == 0)
+			continue;
+		want = n - got;
+		if (want > p->weight[idx])
+			want = p->weight[idx];
+		got += ring_prio_take(p, (unsigned)idx, objs + got, want);
+	}
+	p->cursor = from;
+	return got;
+}
+
+RING_API struct ring *
+ring_prio_lane(struct ring_prio *p, unsigned lane) {
+	return RING_PRIO_LANE(p, lane);
+}
+
+struct ring_bcast_reader {
+	uint32_t head;		/* Elements popped by the reader. */
+	uint32_t cached;	/* Producer tail seen by the reader. */
+} ring_padded;
+
+struct ring_bcast_prod {
+	uint32_t tail;		/* Elements pushed. */
+	uint32_t min;		/* Head of the slowest reader seen by the producer. */
+};
+
+struct ring_bcast {
+	/* Read only after init, by the producer and every reader. */
+	uint32_t size;
+	uint32_t mask;
+	uint32_t esize;
+	uint32_t nreaders;
+
+	/* Producer, written on every push, readers only read tail. */
+	struct ring_bcast_prod prod ring_padded;
+
+	/* Readers. */
+	struct ring_bcast_reader readers[0] ring_padded;
+};
+
+/* Ring data of a broadcast ring, after the reader cursors. */
+#define RING_BCAST_DATA(b) ((uint8_t *)((b)->readers + (b)->nreaders))
+
+RING_API size_t
+ring_bcast_memsize(unsigned count, unsigned esize, unsigned readers) {
+	if (readers == 0 || ring_elem_memsize(count, esize) == 0)
+		return 0;
+	return sizeof(struct ring_bcast) + readers * sizeof(struct ring_bcast_reader)
+		+ (size_t)count * esize;
+}
+
+RING_API void
+ring_bcast_init(struct ring_bcast *b, unsigned count, unsigned esize, unsigned readers) {
+	unsigned i;
+
+	memset(b, 0, sizeof(*b) + readers * sizeof(struct ring_bcast_reader));
+	b->size = count;
+	b->mask = count - 1;
+	b->esize = esize;
+	b->nreaders = readers;
+	b->prod.tail = b->prod.min = (uint32_t)RING_INIT_INDEX;
+	for (i = 0; i < readers; i++)
+		b->readers[i].head = b->readers[i].cached = (uint32_t)RING_INIT_INDEX;
+}
+
+RING_API unsigned
+ring_bcast_push(struct ring_bcast *b, const void *objs, unsigned n, int behavior) {
+	const uint32_t tail = b->prod.tail;
+	uint32_t avail, idx, i, lag, max;
+	uint8_t *ring = RING_BCAST_DATA(b);
+
+	avail = b->mask + b->prod.min - tail;
+	if (n > avail) {
+		/* Refresh the slowest reader, only when the ring looks full. */
+		max = 0;
+		for (i = 0; i < b->nreaders; i++) {
+			lag = tail - LOAD_ACQUIRE(&b->readers[i].head);
+			if (lag > max)
+				max = lag;
+		}
+		b->prod.min = tail - max;
+		avail = b->mask - max;
+		if (n > avail) {
+			if (behavior == RING_B_FIXED || avail == 0)
 				return 0;
-			} else {
-				if (unlikely(avail == 0)) {
-					return 0;
-				}
-				n = avail;
-			}
+			n = avail;
 		}
-		prod_next = prod_head + n;
-		ok = CAS(&r->prod.head, prod_head, prod_next);
-	} while (unlikely(!ok));
+	}
 
-	PUSH_PTRS();
-	compiler_barrier();
+	idx = tail & b->mask;
+	if (likely(idx + n <= b->size)) {
+		copy_elems(ring + (size_t)idx * b->esize, objs, n, b->esize);
+	} else {
+		const uint32_t first = b->size - idx;
+		copy_elems(ring + (size_t)idx * b->esize, objs, first, b->esize);
+		copy_elems(ring, (const uint8_t *)objs + (size_t)first * b->esize, n - first, b->esize);
+	}
+	STORE_RELEASE(&b->prod.tail, tail + n);
+	return n;
+}
 
-	int rep = 0;
-	while (unlikely(r->prod.tail != prod_head)) {
-		_mm_pause();
-		if (RING_PAUSE_REP && ++rep == RING_PAUSE_REP) {
-			rep = 0;
-			sched_yield();
+RING_API unsigned
+ring_bcast_pop(struct ring_bcast *b, unsigned reader, void *objs, unsigned n, int behavior) {
+	struct ring_bcast_reader *rd = &b->readers[reader];
+	const uint32_t head = rd->head;
+	const uint8_t *ring = RING_BCAST_DATA(b);
+	uint32_t avail, idx;
+
+	avail = rd->cached - head;
+	if (n > avail) {
+		rd->cached = LOAD_ACQUIRE(&b->prod.tail);
+		avail = rd->cached - head;
+		if (n > avail) {
+			if (behavior == RING_B_FIXED || avail == 0)
+				return 0;
+			n = avail;
 		}
 	}
 
-	r->prod.tail = prod_next;
+	idx = head & b->mask;
+	if (likely(idx + n <= b->size)) {
+		copy_elems(objs, ring + (size_t)idx * b->esize, n, b->esize);
+	} else {
+		const uint32_t first = b->size - idx;
+		copy_elems(objs, ring + (size_t)idx * b->esize, first, b->esize);
+		copy_elems((uint8_t *)objs + (size_t)first * b->esize, ring, n - first, b->esize);
+	}
+	/* Release the slots after the copy. */
+	STORE_RELEASE(&rd->head, head + n);
 	return n;
 }
 
 RING_API unsigned
-ring_push(struct ring *r, void * const *objs, unsigned n, int behavior) {
-	if (r->prod.sp)
-		return ring_sp_push(r, objs, n, behavior);
-	else
-		return ring_mp_push(r, objs, n, behavior);
+ring_bcast_count(const struct ring_bcast *b, unsigned reader) {
+	return LOAD_ACQUIRE(&b->prod.tail) - LOAD_ACQUIRE(&b->readers[reader].head);
 }
 
-#define POP_PTRS() do { \
-	uint32_t idx = cons_head & mask; \
-	const uint32_t size = r->cons.size; \
-	unsigned i; \
-	if (likely(idx + n < size)) { \
-		for (i = 0; i < (n & (~(unsigned)0x3)); i+=4, idx+=4) { \
-			objs[i] = r->ring[idx]; \
-			objs[i+1] = r->ring[idx+1]; \
-			objs[i+2] = r->ring[idx+2]; \
-			objs[i+3] = r->ring[idx+3]; \
-		} \
-		switch (n & 0x3) { \
-			case 3: objs[i++] = r->ring[idx++]; \
-			case 2: objs[i++] = r->ring[idx++]; \
-			case 1: objs[i++] = r->ring[idx++]; \
-		} \
-	} else { \
-		for (i = 0; idx < size; i++, idx++) \
-		objs[i] = r->ring[idx]; \
-		for (idx = 0; i < n; i++, idx++) \
-		objs[i] = r->ring[idx]; \
-	} \
-} while (0)
+struct ring_dyn_seg {
+	struct ring_dyn_seg *next;	/* Linked by the producer when it leaves the segment. */
+	struct ring ring;
+};
 
+struct ring_dyn {
+	uint32_t min;
+	uint32_t max;
+	uint32_t esize;
 
-/* Single consumer pop on the ring. */
-static unsigned
-ring_sc_pop(struct ring *r, void **objs, unsigned n, int behavior) {
-	uint32_t cons_head, prod_tail;
-	uint32_t cons_next, avail;
-	uint32_t mask = r->prod.mask;
+	/* Producer. */
+	struct ring_dyn_seg *tail ring_padded;
+	uint32_t pushed;	/* Elements pushed in this round of the segment. */
+	uint32_t low;		/* Rounds ended under a quarter full. */
 
-	cons_head = r->cons.head;
-	prod_tail = r->prod.tail;
-	avail = prod_tail - cons_head;
+	/* Consumer. */
+	struct ring_dyn_seg *head ring_padded;
+};
 
-	if (n > avail) {
-		if (behavior == RING_B_FIXED) {
-			return 0;
-		} else {
-			if (unlikely(avail == 0)) {
-				return 0;
+static struct ring_dyn_seg *
+ring_dyn_seg_new(unsigned count, unsigned esize) {
+	struct ring_dyn_seg *seg;
+	size_t sz = offsetof(struct ring_dyn_seg, ring) + ring_elem_memsize(count, esize);
+
+	if (posix_memalign((void **)&seg, RING_CACHE_PAD, sz) != 0)
+		return NULL;
+	seg->next = NULL;
+	ring_elem_init(&seg->ring, count, esize, RING_F_SP | RING_F_SC);
+	return seg;
+}
+
+/* Link a segment of count elements after the producer one. */
+static int
+ring_dyn_link(struct ring_dyn *d, unsigned count) {
+	struct ring_dyn_seg *seg = ring_dyn_seg_new(count, d->esize);
+
+	if (!seg)
+		return 0;
+	/* Release the pushes on the old segment, it is frozen from now. */
+	STORE_RELEASE(&d->tail->next, seg);
+	d->tail = seg;
+	d->pushed = d->low = 0;
+	return 1;
+}
+
+RING_API struct ring_dyn *
+ring_dyn_create(unsigned min, unsigned max, unsigned esize) {
+	struct ring_dyn *d;
+
+	if (min < 2 || min > max || ring_elem_memsize(min, esize) == 0
+		|| ring_elem_memsize(max, esize) == 0)
+		return NULL;
+	if (posix_memalign((void **)&d, RING_CACHE_PAD, sizeof(*d)) != 0)
+		return NULL;
+	memset(d, 0, sizeof(*d));
+	d->min = min;
+	d->max = max;
+	d->esize = esize;
+	d->head = d->tail = ring_dyn_seg_new(min, esize);
+	if (!d->head) {
+		free(d);
+		return NULL;
+	}
+	return d;
+}
+
+RING_API void
+ring_dyn_free(struct ring_dyn *d) {
+	struct ring_dyn_seg *seg = d->head, *next;
+
+	while (seg) {
+		next = seg->next;
+		free(seg);
+		seg = next;
+	}
+	free(d);
+}
+
+RING_API unsigned
+ring_dyn_push(struct ring_dyn *d, const void *objs, unsigned n, int behavior) {
+	struct ring_dyn_seg *seg = d->tail;
+	const uint32_t size = seg->ring.prod.size;
+	unsigned free_space, k, next;
+
+	k = ring_do_push(&seg->ring, objs, d->esize, n, behavior, &free_space);
+	if (likely(k == n)) {
+		if (unlikely(size > d->min) && (d->pushed += n) >= size) {
+			/**
+			 * Shrink after two rounds ended under a quarter full, the
+			 * consumer tail is read once a round, not on every push.
+			 */
+			d->pushed = 0;
+			if (ring_count(&seg->ring) < size / 4) {
+				if (++d->low >= 2)
+					ring_dyn_link(d, size / 2);
+			} else {
+				d->low = 0;
 			}
-			n = avail;
 		}
+		return n;
 	}
-	cons_next = cons_head + n;
-	r->cons.head = cons_next;
-
-	POP_PTRS();
-	compiler_barrier();
 
-	r->cons.tail = cons_next;
-	return n;
+	/* Full, grow and push the rest on the new segment. */
+	if (size == d->max)
+		return k;
+	next = size * 2;
+	/* A fixed batch goes at once, grow to fit it up to max. */
+	if (behavior == RING_B_FIXED && n > next - 1) {
+		if (n > d->max - 1)
+			return k;
+		next = align32_pow2(n + 1);
+	}
+	if (!ring_dyn_link(d, next))
+		return k;
+	return k + ring_do_push(&d->tail->ring, (const uint8_t *)objs + k * d->esize,
+		d->esize, n - k, behavior, &free_space);
 }
 
-/* Multi consumer pop on the ring. */
+/* Pop across segments, free the drained ones. */
 static unsigned
-ring_mc_pop(struct ring *r, void **objs, unsigned n, int behavior) {
-	uint32_t cons_head, prod_tail;
-	uint32_t cons_next, avail;
-	uint32_t mask = r->prod.mask;
-	const unsigned max = n;
-	int ok;
+ring_dyn_pop_slow(struct ring_dyn *d, uint8_t *objs, unsigned n, int behavior) {
+	struct ring_dyn_seg *seg, *next;
+	unsigned got = 0, total = 0, available;
 
-	do {
-		n = max;
+	if (behavior == RING_B_FIXED) {
+		/* A lower bound, counts of frozen segments are final. */
+		for (seg = d->head; seg && total < n; seg = LOAD_ACQUIRE(&seg->next))
+			total += ring_count(&seg->ring);
+		if (total < n)
+			return 0;
+	}
+	while (got < n) {
+		seg = d->head;
+		got += ring_do_pop(&seg->ring, objs + got * d->esize, d->esize, n - got,
+			RING_B_VARIABLE, &available);
+		if (got == n)
+			break;
+		next = LOAD_ACQUIRE(&seg->next);
+		if (!next)
+			break;
+		/* The producer pushes no more on seg after next is linked. */
+		if (!ring_empty(&seg->ring))
+			continue;
+		d->head = next;
+		free(seg);
+	}
+	return got;
+}
 
-		cons_head = r->cons.head;
-		prod_tail = r->prod.tail;
-		avail = prod_tail - cons_head;
+RING_API unsigned
+ring_dyn_pop(struct ring_dyn *d, void *objs, unsigned n, int behavior) {
+	struct ring_dyn_seg *seg = d->head;
+	unsigned k, available;
 
-		if (n > avail) {
-			if (behavior == RING_B_FIXED) {
-				return 0;
-			} else {
-				if (unlikely(avail == 0)) {
-					return 0;
-				}
-				n = avail;
+	k = ring_do_pop(&seg->ring, objs, d->esize, n, behavior, &available);
+	if (likely(k > 0))
+		return k;
+	if (likely(LOAD_RELAXED(&seg->next) == NULL))
+		return 0;
+	return ring_dyn_pop_slow(d, (uint8_t *)objs, n, behavior);
+}
+
+RING_API unsigned
+ring_dyn_size(const struct ring_dyn *d) {
+	return d->tail->ring.prod.size;
+}
+
+/* Length of a padding record, skipped up to the ring end. */
+#define RING_MSG_PAD UINT32_MAX
+
+/**
+ * Header of a message record, a 8 bytes ring slot. head is prod.head
+ * before the reservation (low 32 bits), so commit finds the padding
+ * and the tail to wait for.
+ */
+struct ring_msg_hdr {
+	uint32_t len;
+	uint32_t head;
+};
+
+/* Slots of a record of len bytes, header included. */
+#define RING_MSG_SLOTS(len) (1 + (((len) + 7) >> 3))
+
+RING_API size_t
+ring_msg_memsize(unsigned bytes) {
+	if (bytes < 16)
+		return 0;
+	return ring_elem_memsize(bytes / 8, 8);
+}
+
+RING_API void
+ring_msg_init(struct ring *r, unsigned bytes, unsigned flags) {
+	ring_elem_init(r, bytes / 8, 8, (flags & (RING_F_SP | RING_F_WAIT)) | RING_F_SC);
+}
+
+RING_API void *
+ring_msg_reserve(struct ring *r, unsigned len) {
+	struct ring_msg_hdr *slots = (struct ring_msg_hdr *)r->ring;
+	const uint32_t size = r->prod.size;
+	ring_idx_t head, next;
+	uint32_t n, idx, pad, avail;
+	int ok;
+
+	if (unlikely(len > (size / 2 - 1) * 8))
+		return NULL;
+	n = RING_MSG_SLOTS(len);
+	do {
+		head = LOAD_ACQUIRE(&r->prod.head);
+		idx = (uint32_t)(head & r->prod.mask);
+		/* Pad to the end if the record does not fit before it. */
+		pad = idx + n > size ? size - idx : 0;
+		if (r->prod.sync == RING_SYNC_ST) {
+			avail = (uint32_t)(r->prod.capacity + r->prod.cached - head);
+			if (pad + n > avail) {
+				r->prod.cached = ring_load_tail(&r->cons);
+				avail = (uint32_t)(r->prod.capacity + r->prod.cached - head);
 			}
+		} else {
+			avail = (uint32_t)(r->prod.capacity + ring_load_tail(&r->cons) - head);
 		}
-		cons_next = cons_head + n;
-		ok = CAS(&r->cons.head, cons_head, cons_next);
+		if (unlikely(pad + n > avail)) {
+			RING_STAT_ADD(&r->prod, fail, 1);
+			return NULL;
+		}
+		next = head + pad + n;
+		if (r->prod.sync == RING_SYNC_ST) {
+			STORE_RELAXED(&r->prod.head, next);
+			break;
+		}
+		ok = CAS(&r->prod.head, head, next);
+		if (unlikely(!ok))
+			RING_STAT_ADD(&r->prod, retry, 1);
 	} while (unlikely(!ok));
 
-	POP_PTRS();
-	compiler_barrier();
+	if (pad) {
+		slots[idx].len = RING_MSG_PAD;
+		slots[idx].head = (uint32_t)head;
+		idx = 0;
+	}
+	slots[idx].len = len;
+	slots[idx].head = (uint32_t)head;
+	return &slots[idx + 1];
+}
 
+RING_API void
+ring_msg_commit(struct ring *r, void *msg) {
+	struct ring_msg_hdr *hdr = (struct ring_msg_hdr *)msg - 1;
+	const uint32_t idx = (uint32_t)(hdr - (struct ring_msg_hdr *)r->ring);
+	const uint32_t head = hdr->head;
+	uint32_t n = RING_MSG_SLOTS(hdr->len);
+	ring_idx_t tail;
 	int rep = 0;
-	while (unlikely(r->cons.tail != cons_head)) {
-		_mm_pause();
-		if (RING_PAUSE_REP && ++rep == RING_PAUSE_REP) {
-			rep = 0;
-			sched_yield();
-		}
+
+	if (idx != (head & r->prod.mask))
+		n += r->prod.size - (head & r->prod.mask);
+	/* Reservations are less than 2^32 slots apart, low bits are enough. */
+	while (unlikely((uint32_t)(tail = ring_load_tail(&r->prod)) != head)) {
+		ring_backoff(&r->prod, &rep, RING_TAIL_WORD(&r->prod), (uint32_t)tail);
+		RING_STAT_ADD(&r->prod, spin, 1);
+	}
+	STORE_RELEASE(&r->prod.tail, tail + n);
+	RING_STAT_ADD(&r->prod, ok, 1);
+	RING_STAT_ADD(&r->prod, objs, n);
+	ring_notify(&r->prod);
+}
+
+RING_API const void *
+ring_msg_read(struct ring *r, unsigned *len) {
+	const struct ring_msg_hdr *slots = (const struct ring_msg_hdr *)r->ring;
+	ring_idx_t tail = LOAD_RELAXED(&r->cons.tail);
+	uint32_t idx;
+
+	if (r->cons.cached == tail) {
+		r->cons.cached = ring_load_tail(&r->prod);
+		if (r->cons.cached == tail)
+			return NULL;
+	}
+	idx = (uint32_t)(tail & r->cons.mask);
+	if (slots[idx].len == RING_MSG_PAD) {
+		/* Released with the record after it, committed together. */
+		tail += r->cons.size - idx;
+		idx = 0;
+	}
+	*len = slots[idx].len;
+	STORE_RELAXED(&r->cons.head, tail + RING_MSG_SLOTS(slots[idx].len));
+	return &slots[idx + 1];
+}
+
+RING_API void
+ring_msg_release(struct ring *r) {
+	ring_idx_t cons_head = LOAD_RELAXED(&r->cons.head);
+
+	RING_STAT_ADD(&r->cons, ok, 1);
+	RING_STAT_ADD(&r->cons, objs, (unsigned)(cons_head - LOAD_RELAXED(&r->cons.tail)));
+	STORE_RELEASE(&r->cons.tail, cons_head);
+	ring_notify(&r->cons);
+}
+
+struct ring_mempool {
+	uint8_t *objs;		/* Object area, n * obj_size bytes. */
+	size_t obj_size;
+	unsigned n;
+	struct ring ring;
+};
+
+RING_API struct ring_mempool *
+ring_mempool_create(unsigned n, unsigned obj_size, unsigned flags) {
+	struct ring_mempool *mp;
+	size_t sz = ring_exact_memsize(n);
+	size_t osz = ((size_t)obj_size + 7) & ~(size_t)7;
+	unsigned i;
+
+	if (sz == 0 || obj_size == 0)
+		return NULL;
+	if (posix_memalign((void **)&mp, RING_CACHE_PAD, offsetof(struct ring_mempool, ring) + sz) != 0)
+		return NULL;
+	if (posix_memalign((void **)&mp->objs, CACHE_LINE_SIZE, osz * n) != 0) {
+		free(mp);
+		return NULL;
 	}
+	mp->obj_size = osz;
+	mp->n = n;
+	ring_init(&mp->ring, n, flags | RING_F_EXACT_SZ);
+	for (i = 0; i < n; i++) {
+		void *obj = mp->objs + osz * i;
+
+		ring_push(&mp->ring, &obj, 1, RING_B_FIXED);
+	}
+	return mp;
+}
+
+RING_API void
+ring_mempool_free(struct ring_mempool *mp) {
+	free(mp->objs);
+	free(mp);
+}
+
+RING_API void
+ring_mempool_cache_init(struct ring_mempool_cache *c, unsigned size) {
+	c->size = size < RING_MEMPOOL_CACHE_MAX ? size : RING_MEMPOOL_CACHE_MAX;
+	c->len = 0;
+}
+
+RING_API void
+ring_mempool_cache_flush(struct ring_mempool *mp, struct ring_mempool_cache *c) {
+	if (c->len)
+		ring_push(&mp->ring, c->objs, c->len, RING_B_FIXED);
+	c->len = 0;
+}
 
-	r->cons.tail = cons_next;
+/* Get n objects of the pool ring, prefetched for the caller to write. */
+static inline unsigned
+ring_mempool_dequeue(struct ring_mempool *mp, void **objs, unsigned n, int behavior) {
+	unsigned i;
+
+	n = ring_pop(&mp->ring, objs, n, behavior);
+	for (i = 0; i < n; i++)
+		__builtin_prefetch(objs[i], 1);
 	return n;
 }
 
 RING_API unsigned
-ring_pop(struct ring *r, void **objs, unsigned n, int behavior) {
-	if (r->cons.sc)
-		return ring_sc_pop(r, objs, n, behavior);
-	else
-		return ring_mc_pop(r, objs, n, behavior);
+ring_mempool_get(struct ring_mempool *mp, struct ring_mempool_cache *c, void **objs, unsigned n) {
+	unsigned i;
+
+	if (unlikely(!c || n > c->size))
+		return ring_mempool_dequeue(mp, objs, n, RING_B_FIXED);
+	if (unlikely(c->len < n)) {
+		/* Refill up to size objects left after this get. */
+		c->len += ring_mempool_dequeue(mp, &c->objs[c->len], c->size + n - c->len, RING_B_VARIABLE);
+		if (unlikely(c->len < n))
+			return 0;
+	}
+	for (i = 0; i < n; i++)
+		objs[i] = c->objs[--c->len];
+	return n;
 }
 
-RING_API int
-ring_full(const struct ring *r) {
-	uint32_t prod_tail = r->prod.tail;
-	uint32_t cons_tail = r->cons.tail;
-	return (((cons_tail - prod_tail - 1) & r->prod.mask) == 0);
+RING_API void
+ring_mempool_put(struct ring_mempool *mp, struct ring_mempool_cache *c, void * const *objs, unsigned n) {
+	unsigned i;
+
+	if (unlikely(!c || n > c->size)) {
+		ring_push(&mp->ring, objs, n, RING_B_FIXED);
+		return;
+	}
+	if (unlikely(c->len + n > 2 * c->size)) {
+		/* Flush down to size objects left after this put. */
+		unsigned k = c->len + n - c->size;
+
+		ring_push(&mp->ring, c->objs, k, RING_B_FIXED);
+		c->len -= k;
+		memmove(c->objs, &c->objs[k], c->len * sizeof(void *));
+	}
+	for (i = 0; i < n; i++)
+		c->objs[c->len++] = objs[i];
+}
+
+RING_API unsigned
+ring_mempool_avail(const struct ring_mempool *mp) {
+	return ring_count(&mp->ring);
+}
+
+/**
+ * Chase-Lev deque, the C11 ordering of Le et al. "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" with seq_cst accesses in place
+ * of the fences. Indexes are 64bit and never wrap, top only grows.
+ */
+struct ring_deque {
+	uint32_t size;
+	uint32_t mask;
+
+	/* Next object to steal, moved by thieves and the last pop with CAS. */
+	int64_t top ring_padded;
+
+	/* Next free slot, written by the owner only. */
+	int64_t bottom ring_padded;
+
+	void *slots[0] ring_padded;
+};
+
+RING_API size_t
+ring_deque_memsize(unsigned count) {
+	if (count < 2 || !POWEROF2(count) || count > RING_SIZE_MAX)
+		return 0;
+	return sizeof(struct ring_deque) + (size_t)count * sizeof(void *);
+}
+
+RING_API void
+ring_deque_init(struct ring_deque *d, unsigned count) {
+	memset(d, 0, sizeof(*d));
+	d->size = count;
+	d->mask = count - 1;
 }
 
 RING_API int
-ring_empty(const struct ring *r) {
-	uint32_t prod_tail = r->prod.tail;
-	uint32_t cons_tail = r->cons.tail;
-	return !!(cons_tail == prod_tail);
+ring_deque_push(struct ring_deque *d, void *obj) {
+	int64_t b = LOAD_RELAXED(&d->bottom);
+	int64_t t = LOAD_ACQUIRE(&d->top);
+
+	if (unlikely(b - t >= (int64_t)d->size))
+		return 0;
+	/* Slots are atomic, a thief may read a slot it then fails to CAS. */
+	STORE_RELAXED(&d->slots[b & d->mask], obj);
+	STORE_RELEASE(&d->bottom, b + 1);
+	return 1;
+}
+
+RING_API void *
+ring_deque_pop(struct ring_deque *d) {
+	int64_t b = LOAD_RELAXED(&d->bottom) - 1;
+	int64_t t;
+	void *obj;
+
+	/* Take the slot before reading top, ordered with the thief top/bottom reads. */
+	__atomic_store_n(&d->bottom, b, __ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+	if (unlikely(t > b)) {
+		/* Empty. */
+		STORE_RELAXED(&d->bottom, b + 1);
+		return NULL;
+	}
+	obj = LOAD_RELAXED(&d->slots[b & d->mask]);
+	if (t == b) {
+		/* Last object, race thieves for it. */
+		if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			obj = NULL;
+		STORE_RELAXED(&d->bottom, b + 1);
+	}
+	return obj;
+}
+
+RING_API void *
+ring_deque_steal(struct ring_deque *d) {
+	int64_t t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+	int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+	void *obj;
+
+	if (t >= b)
+		return NULL;
+	obj = LOAD_RELAXED(&d->slots[t & d->mask]);
+	if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+	return obj;
 }
 
 RING_API unsigned
-ring_count(const struct ring *r) {
-	uint32_t prod_tail = r->prod.tail;
-	uint32_t cons_tail = r->cons.tail;
-	return ((prod_tail - cons_tail) & r->prod.mask);
+ring_deque_steal_half(struct ring_deque *d, struct ring *r) {
+	void *objs[RING_DEQUE_STEAL_MAX];
+	int64_t t = LOAD_ACQUIRE(&d->top);
+	int64_t b = LOAD_ACQUIRE(&d->bottom);
+	unsigned i, n, room = ring_avail(r);
+
+	if (t >= b)
+		return 0;
+	/* Half rounded up, so a single object can be stolen too. */
+	n = (unsigned)((b - t + 1) / 2);
+	if (n > room)
+		n = room;
+	if (n > RING_DEQUE_STEAL_MAX)
+		n = RING_DEQUE_STEAL_MAX;
+	/*
+	 * One CAS per object, a CAS over several slots would race with the
+	 * owner popping them without CAS, as it only checks the last one.
+	 */
+	for (i = 0; i < n; i++) {
+		if (!(objs[i] = ring_deque_steal(d)))
+			break;
+	}
+	if (i > 0)
+		ring_push(r, objs, i, RING_B_FIXED);
+	return i;
 }
 
 RING_API unsigned
-ring_avail(const struct ring *r) {
-	uint32_t prod_tail = r->prod.tail;
-	uint32_t cons_tail = r->cons.tail;
-	return ((cons_tail - prod_tail - 1) & r->prod.mask);
+ring_deque_count(const struct ring_deque *d) {
+	int64_t t = LOAD_ACQUIRE(&d->top);
+	int64_t b = LOAD_ACQUIRE(&d->bottom);
+
+	return b > t ? (unsigned)(b - t) : 0;
 }
 
 #endif // RING_IMPLEMENTATION
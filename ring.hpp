@@ -0,0 +1,344 @@
+/**
+ * author: zhoukk
+ * link: https://github.com/zhoukk/ring
+ *
+ * C++ typed ring over ring.h, element type, capacity and
+ * producer/consumer policy are template parameters. The queue is
+ * a struct ring of sizeof(T) elements driven by the zero copy
+ * ring_push_start/ring_pop_start, so elements are moved in place
+ * of the slots (move only types ok), with the same algorithm as
+ * the C rings. One translation unit must define RING_IMPLEMENTATION.
+ *
+ * ringpp::queue<std::unique_ptr<msg>, 1024, ringpp::spsc> q;
+ *
+ * In C++20, ringpp::async_ring lets a coroutine co_await the objects
+ * of a struct ring, resumed by an executor after producers push.
+ *
+ * The namespace is not ring, as it would clash with struct ring.
+ */
+
+#ifndef _ring_hpp_
+#define _ring_hpp_
+
+#include "ring.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define RINGPP_COROUTINE 1
+#endif
+#endif
+
+namespace ringpp {
+
+/**
+ * Producer/consumer policy of a queue.
+ */
+struct spsc { static constexpr bool sp = true, sc = true; };	/* Single producer, single consumer. */
+struct mpsc { static constexpr bool sp = false, sc = true; };	/* Multi producer, single consumer. */
+struct spmc { static constexpr bool sp = true, sc = false; };	/* Single producer, multi consumer. */
+struct mpmc { static constexpr bool sp = false, sc = false; };	/* Multi producer, multi consumer. */
+
+/**
+ * Fixed size FIFO of N - 1 elements of T (N must be power of 2), a
+ * struct ring with RING_F_SP/RING_F_SC for the single sides of Policy
+ * and RING_F_MP_HTS/RING_F_MC_HTS for the multi ones, as zero copy
+ * needs HTS (so RING_INDEX64 builds only have spsc). Elements are
+ * constructed in the slots by push and destroyed by pop, T must be
+ * nothrow move constructible and assignable, as a slot reserved by
+ * a thread must be published.
+ */
+template <typename T, std::size_t N, typename Policy = mpmc>
+class queue {
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be power of 2");
+	static_assert(N <= RING_SIZE_MAX, "N greater than RING_SIZE_MAX");
+	static_assert(alignof(T) <= RING_CACHE_PAD, "T aligned over RING_CACHE_PAD");
+	static_assert(std::is_nothrow_move_constructible<T>::value,
+		"T must be nothrow move constructible");
+	static_assert(std::is_nothrow_move_assignable<T>::value,
+		"T must be nothrow move assignable");
+#ifdef RING_INDEX64
+	static_assert(Policy::sp && Policy::sc, "RING_INDEX64 has no HTS, only spsc");
+#endif
+
+public:
+	typedef T value_type;
+
+	static constexpr uint32_t mask = N - 1;
+	static constexpr std::size_t capacity = N - 1;
+
+	queue() {
+		std::size_t sz = ring_elem_memsize(N, esize);
+		void *p;
+
+		if (sz == 0 || posix_memalign(&p, RING_CACHE_PAD, sz) != 0)
+			throw std::bad_alloc();
+		r_ = static_cast<struct ring *>(p);
+		ring_elem_init(r_, N, esize, flags);
+	}
+
+	queue(const queue &) = delete;
+	queue &operator=(const queue &) = delete;
+
+	~queue() {
+		struct ring_zc_data zcd;
+		unsigned i, n;
+
+		n = ring_pop_start(r_, capacity, RING_B_VARIABLE, &zcd);
+		for (i = 0; i < n; i++)
+			slot(zcd, i)->~T();
+		free(r_);
+	}
+
+	/**
+	 * Push n objects moved from objs.
+	 *
+	 * @param objs
+	 *		The objects to push, left moved from if pushed.
+	 * @param n
+	 *		The number of objects.
+	 * @param behavior
+	 *		RING_B_FIXED or RING_B_VARIABLE, same as ring_push.
+	 * @return
+	 *		Number of objects pushed.
+	 */
+	std::size_t
+	push(T *objs, std::size_t n, int behavior = RING_B_FIXED) {
+		struct ring_zc_data zcd;
+		unsigned i, k;
+
+		k = ring_push_start(r_, (unsigned)n, behavior, &zcd);
+		for (i = 0; i < k; i++)
+			::new (static_cast<void *>(slot(zcd, i))) T(std::move(objs[i]));
+		if (k)
+			ring_push_finish(r_, k);
+		return k;
+	}
+
+	/**
+	 * Pop n objects move assigned to objs.
+	 *
+	 * @param objs
+	 *		The objects that will be filled.
+	 * @param n
+	 *		The number of objects.
+	 * @param behavior
+	 *		RING_B_FIXED or RING_B_VARIABLE, same as ring_pop.
+	 * @return
+	 *		Number of objects poped.
+	 */
+	std::size_t
+	pop(T *objs, std::size_t n, int behavior = RING_B_FIXED) {
+		struct ring_zc_data zcd;
+		unsigned i, k;
+
+		k = ring_pop_start(r_, (unsigned)n, behavior, &zcd);
+		for (i = 0; i < k; i++) {
+			T *p = slot(zcd, i);
+
+			objs[i] = std::move(*p);
+			p->~T();
+		}
+		if (k)
+			ring_pop_finish(r_, k);
+		return k;
+	}
+
+	/**
+	 * Construct one object in place, false if the queue is full.
+	 * If the constructor may throw, the object is built before the
+	 * slot is reserved and moved in, an exception leaves the queue
+	 * unchanged.
+	 */
+	template <typename... Args>
+	bool
+	emplace(Args &&... args) {
+		return emplace_slot(std::is_nothrow_constructible<T, Args &&...>(),
+			std::forward<Args>(args)...);
+	}
+
+	bool push(T &&v) { return emplace(std::move(v)); }
+	bool push(const T &v) { return emplace(v); }
+	bool pop(T &v) { return pop(&v, 1) == 1; }
+
+	/* Number of entries, may be stale as other threads go on. */
+	std::size_t size() const { return ring_count(r_); }
+
+	bool empty() const { return ring_empty(r_); }
+	bool full() const { return ring_full(r_); }
+
+	/* The struct ring under the queue, for ring_stats_get and such. */
+	struct ring *get() const { return r_; }
+
+private:
+	/* Slot size, ring elements are multiple of 4 bytes. */
+	static constexpr unsigned esize = (sizeof(T) + 3) & ~3u;
+#ifdef RING_INDEX64
+	static constexpr unsigned flags = RING_F_SP | RING_F_SC;
+#else
+	static constexpr unsigned flags = (Policy::sp ? RING_F_SP : RING_F_MP_HTS)
+		| (Policy::sc ? RING_F_SC : RING_F_MC_HTS);
+#endif
+
+	/* Slot i of the reserved spans. */
+	static T *
+	slot(const struct ring_zc_data &zcd, unsigned i) {
+		unsigned char *p = i < zcd.n1
+			? static_cast<unsigned char *>(zcd.ptr1) + (std::size_t)i * esize
+			: static_cast<unsigned char *>(zcd.ptr2) + (std::size_t)(i - zcd.n1) * esize;
+
+		return reinterpret_cast<T *>(p);
+	}
+
+	template <typename... Args>
+	bool
+	emplace_slot(std::true_type, Args &&... args) {
+		struct ring_zc_data zcd;
+
+		if (!ring_push_start(r_, 1, RING_B_FIXED, &zcd))
+			return false;
+		::new (zcd.ptr1) T(std::forward<Args>(args)...);
+		ring_push_finish(r_, 1);
+		return true;
+	}
+
+	template <typename... Args>
+	bool
+	emplace_slot(std::false_type, Args &&... args) {
+		T v(std::forward<Args>(args)...);
+
+		return emplace_slot(std::true_type(), std::move(v));
+	}
+
+	struct ring *r_;
+};
+
+#ifdef RINGPP_COROUTINE
+
+/* Executor resuming the consumer in the producer thread, at its push. */
+struct inline_executor {
+	void post(std::coroutine_handle<> h) { h.resume(); }
+};
+
+/**
+ * Awaitable view of a struct ring of pointers for one consumer coroutine,
+ * co_await pop_batch suspends it while the ring is empty. A producer after
+ * its push takes the parked coroutine, if any, and posts it to Executor
+ * (void post(std::coroutine_handle<>)). The slot is empty until the
+ * consumer parks again, so pushes of a burst before it runs post nothing
+ * and one resume pops the whole burst. Producers pay a fence and a load of
+ * the slot line per push, no syscall.
+ *
+ * ringpp::async_ring<loop_executor> q(r, loop);
+ * unsigned n = co_await q.pop_batch(objs, 32);
+ */
+template <typename Executor = inline_executor>
+class async_ring {
+public:
+	class pop_awaiter {
+	public:
+		pop_awaiter(async_ring &q, void **objs, unsigned n) : q_(q), objs_(objs), n_(n) {}
+
+		bool
+		await_ready() {
+			got_ = ring_pop(q_.r_, objs_, n_, RING_B_VARIABLE);
+			return got_ != 0;
+		}
+
+		bool
+		await_suspend(std::coroutine_handle<> h) {
+			struct ring *r = q_.r_;
+			std::atomic<void *> &w = q_.waiter_;
+			Executor &ex = q_.ex_;
+
+			/*
+			 * Park, then check the ring again, pairs with the fence of
+			 * notify, so either it sees the parked coroutine or we see its
+			 * objects. Once parked the frame may be resumed by the executor,
+			 * only locals are used.
+			 */
+			w.store(h.address(), std::memory_order_release);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (ring_count(r) == 0)
+				return true;
+			/*
+			 * Objects arrived, take back whatever is parked and post it. It
+			 * may be this coroutine parked again after a producer resumed it,
+			 * so never resume inline by returning false.
+			 */
+			void *a = w.exchange(nullptr, std::memory_order_acquire);
+			if (a)
+				ex.post(std::coroutine_handle<>::from_address(a));
+			return true;
+		}
+
+		/* Objects popped, 0 only if another consumer of the ring took them. */
+		unsigned
+		await_resume() {
+			if (got_ == 0)
+				got_ = ring_pop(q_.r_, objs_, n_, RING_B_VARIABLE);
+			return got_;
+		}
+
+	private:
+		async_ring &q_;
+		void **objs_;
+		unsigned n_;
+		unsigned got_ = 0;
+	};
+
+	async_ring(struct ring *r, Executor &ex) : r_(r), ex_(ex) {}
+	async_ring(const async_ring &) = delete;
+	async_ring &operator=(const async_ring &) = delete;
+
+	/**
+	 * Pop up to n objects, RING_B_VARIABLE, suspend while the ring is
+	 * empty. One consumer coroutine may wait at a time.
+	 */
+	pop_awaiter
+	pop_batch(void **objs, unsigned n) {
+		return pop_awaiter(*this, objs, n);
+	}
+
+	/* ring_push, then resume the parked consumer if any. */
+	unsigned
+	push(void * const *objs, unsigned n, int behavior = RING_B_FIXED) {
+		n = ring_push(r_, objs, n, behavior);
+		if (n)
+			notify();
+		return n;
+	}
+
+	/* Post the parked consumer, call after each push made with ring_push. */
+	void
+	notify() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiter_.load(std::memory_order_relaxed) == nullptr)
+			return;
+		void *a = waiter_.exchange(nullptr, std::memory_order_acquire);
+		if (a)
+			ex_.post(std::coroutine_handle<>::from_address(a));
+	}
+
+	struct ring *get() const { return r_; }
+
+private:
+	struct ring *r_;
+	Executor &ex_;
+	/* Parked consumer coroutine, on its own line, read by every push. */
+	alignas(RING_CACHE_PAD) std::atomic<void *> waiter_{nullptr};
+};
+
+#endif // RINGPP_COROUTINE
+
+} // namespace ringpp
+
+#endif // _ring_hpp_
@@ -0,0 +1,929 @@
+/**
+ * Benchmark of ring.
+ *
+ * cc -O2 -pthread -o ring_bench ring_bench.c
+ *
+ * Sweep producer/consumer counts, batch sizes and push/pop behavior,
+ * report throughput, cycles per object and push to pop latency
+ * percentiles from timestamped objects.
+ *
+ * -V rounds runs the verify mode instead, random thread counts, sync
+ * types and bursts, each object is checked popped once and in order
+ * of its producer. Build it with -fsanitize=thread and
+ * -DRING_INIT_INDEX=0xfffffc00 to cross the index wraparound.
+ */
+
+#define _GNU_SOURCE
+#define RING_IMPLEMENTATION
+#include "ring.h"
+
+#include <getopt.h>
+#include <pthread.h>
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_BATCH 256
+#define BENCH_SAMPLE_MASK 63	/* Sample latency every 64 objects. */
+#define BENCH_SEQ_BITS 40	/* Verify object is producer id + 1 << 40 | seq. */
+
+/* Time stamp counter, or nanoseconds if not supported. */
+static inline uint64_t
+bench_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t v;
+	asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t
+bench_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Mutex and circular array queue, the baseline of lock free ring. */
+struct mutex_queue {
+	pthread_mutex_t lock;
+	unsigned size;
+	unsigned head;
+	unsigned tail;
+	void **objs;
+};
+
+static struct mutex_queue *
+mutex_queue_create(unsigned size) {
+	struct mutex_queue *q = malloc(sizeof(*q));
+
+	pthread_mutex_init(&q->lock, NULL);
+	q->size = size;
+	q->head = q->tail = 0;
+	q->objs = malloc(size * sizeof(void *));
+	return q;
+}
+
+static void
+mutex_queue_free(struct mutex_queue *q) {
+	pthread_mutex_destroy(&q->lock);
+	free(q->objs);
+	free(q);
+}
+
+static unsigned
+mutex_queue_push(struct mutex_queue *q, void * const *objs, unsigned n, int behavior) {
+	unsigned i, avail;
+
+	pthread_mutex_lock(&q->lock);
+	avail = q->size - (q->head - q->tail);
+	if (n > avail) {
+		if (behavior == RING_B_FIXED) {
+			n = 0;
+		} else {
+			n = avail;
+		}
+	}
+	for (i = 0; i < n; i++)
+		q->objs[(q->head + i) % q->size] = objs[i];
+	q->head += n;
+	pthread_mutex_unlock(&q->lock);
+	return n;
+}
+
+static unsigned
+mutex_queue_pop(struct mutex_queue *q, void **objs, unsigned n, int behavior) {
+	unsigned i, count;
+
+	pthread_mutex_lock(&q->lock);
+	count = q->head - q->tail;
+	if (n > count) {
+		if (behavior == RING_B_FIXED) {
+			n = 0;
+		} else {
+			n = count;
+		}
+	}
+	for (i = 0; i < n; i++)
+		objs[i] = q->objs[(q->tail + i) % q->size];
+	q->tail += n;
+	pthread_mutex_unlock(&q->lock);
+	return n;
+}
+
+struct bench_opt {
+	unsigned size;		/* Ring size. */
+	unsigned long objs;	/* Objects pushed by each producer. */
+	unsigned max_prod;
+	unsigned max_cons;
+	unsigned batches[8];
+	unsigned nbatch;
+	int mutex;		/* Run the mutex queue baseline too. */
+	int numa;		/* Producers and consumers on different nodes. */
+	int ring_numa;		/* Ring created by ring_create_numa on ring_node. */
+	int ring_node;
+	int pad;		/* Run the index distance benchmark. */
+	unsigned verify;	/* Rounds of the verify mode, 0 to benchmark. */
+	unsigned seed;
+};
+
+struct bench_ctx {
+	const struct bench_opt *opt;
+	struct ring *r;
+	struct mutex_queue *q;
+	unsigned nprod;
+	unsigned ncons;
+	unsigned batch;
+	int behavior;
+	unsigned long total;
+	unsigned long popped cache_aligned;
+	uint8_t *seen;		/* Verify mode, objects popped, one byte each. */
+	pthread_barrier_t start;
+};
+
+struct bench_thread {
+	struct bench_ctx *ctx;
+	pthread_t tid;
+	int cpu;
+	unsigned id;		/* Producer index of the verify mode. */
+	unsigned seed;		/* Burst sizes of the verify mode. */
+	uint64_t *samples;
+	unsigned long nsample;
+} cache_aligned;
+
+static int bench_ncpu;
+static int bench_cpus[2][BENCH_MAX_THREADS * 2];
+static int bench_ncpus[2];
+
+/* Parse cpu list of a numa node, like 0-3,8-11. */
+static int
+bench_node_cpus(int node, int *cpus, int max) {
+	char path[128], buf[1024], *p;
+	FILE *f;
+	int n = 0;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (!f) {
+		return 0;
+	}
+	if (!fgets(buf, sizeof(buf), f)) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	p = buf;
+	while (*p && *p != '\n' && n < max) {
+		int a = strtol(p, &p, 10), b = a;
+		if (*p == '-')
+			b = strtol(p + 1, &p, 10);
+		for (; a <= b && n < max; a++)
+			cpus[n++] = a;
+		if (*p == ',')
+			p++;
+	}
+	return n;
+}
+
+static void
+bench_cpu_setup(int numa) {
+	int i;
+
+	bench_ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (numa) {
+		bench_ncpus[0] = bench_node_cpus(0, bench_cpus[0], BENCH_MAX_THREADS * 2);
+		bench_ncpus[1] = bench_node_cpus(1, bench_cpus[1], BENCH_MAX_THREADS * 2);
+		if (bench_ncpus[0] > 0 && bench_ncpus[1] > 0) {
+			return;
+		}
+		fprintf(stderr, "numa node 1 not found, ignore numa placement\n");
+	}
+	bench_ncpus[0] = bench_ncpus[1] = 0;
+	for (i = 0; i < bench_ncpu && i < BENCH_MAX_THREADS * 2; i++)
+		bench_cpus[0][bench_ncpus[0]++] = i;
+}
+
+/* Cpu of the idx thread, producers first then consumers. */
+static int
+bench_cpu(int is_cons, unsigned nprod, unsigned idx) {
+	if (bench_ncpus[1] > 0) {
+		return bench_cpus[is_cons][idx % bench_ncpus[is_cons]];
+	}
+	if (is_cons)
+		idx += nprod;
+	return bench_cpus[0][idx % bench_ncpus[0]];
+}
+
+static void
+bench_pin(int cpu) {
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* Ring memory aligned to RING_CACHE_PAD, as the padding of struct ring expects. */
+static struct ring *
+bench_ring_alloc(size_t sz) {
+	void *p;
+
+	if (posix_memalign(&p, RING_CACHE_PAD, sz) != 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return (struct ring *)p;
+}
+
+static inline unsigned
+bench_push(struct bench_ctx *ctx, void * const *objs, unsigned n) {
+	if (ctx->q)
+		return mutex_queue_push(ctx->q, objs, n, ctx->behavior);
+	return ring_push(ctx->r, objs, n, ctx->behavior);
+}
+
+static inline unsigned
+bench_pop(struct bench_ctx *ctx, void **objs, unsigned n) {
+	if (ctx->q)
+		return mutex_queue_pop(ctx->q, objs, n, ctx->behavior);
+	return ring_pop(ctx->r, objs, n, ctx->behavior);
+}
+
+static void *
+bench_producer(void *arg) {
+	struct bench_thread *t = (struct bench_thread *)arg;
+	struct bench_ctx *ctx = t->ctx;
+	void *objs[BENCH_MAX_BATCH];
+	unsigned long left = ctx->opt->objs;
+	int rep = 0;
+
+	bench_pin(t->cpu);
+	pthread_barrier_wait(&ctx->start);
+	while (left > 0) {
+		unsigned i, n = left < ctx->batch ? (unsigned)left : ctx->batch;
+		uint64_t now = bench_tsc();
+
+		/* Object is the push time stamp, never NULL. */
+		for (i = 0; i < n; i++)
+			objs[i] = (void *)(uintptr_t)(now | 1);
+		i = 0;
+		while (i < n) {
+			unsigned m = bench_push(ctx, objs + i, n - i);
+			if (m == 0) {
+				ring_pause();
+				if (++rep >= 64) {
+					rep = 0;
+					sched_yield();
+				}
+				continue;
+			}
+			i += m;
+		}
+		left -= n;
+	}
+	return NULL;
+}
+
+static void *
+bench_consumer(void *arg) {
+	struct bench_thread *t = (struct bench_thread *)arg;
+	struct bench_ctx *ctx = t->ctx;
+	void *objs[BENCH_MAX_BATCH];
+	unsigned long seq = 0;
+	int rep = 0;
+
+	bench_pin(t->cpu);
+	pthread_barrier_wait(&ctx->start);
+	for (;;) {
+		unsigned long left = ctx->total - __atomic_load_n(&ctx->popped, __ATOMIC_RELAXED);
+		unsigned i, n;
+		uint64_t now;
+
+		if (left == 0) {
+			break;
+		}
+		n = bench_pop(ctx, objs, left < ctx->batch ? (unsigned)left : ctx->batch);
+		if (n == 0) {
+			ring_pause();
+			if (++rep >= 64) {
+				rep = 0;
+				sched_yield();
+			}
+			continue;
+		}
+		now = bench_tsc();
+		for (i = 0; i < n; i++, seq++) {
+			if ((seq & BENCH_SAMPLE_MASK) == 0)
+				t->samples[t->nsample++] = now - ((uintptr_t)objs[i] & ~(uintptr_t)1);
+		}
+		__atomic_add_fetch(&ctx->popped, n, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static int
+bench_cmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Run one case, print a result line. */
+static void
+bench_run(const struct bench_opt *opt, unsigned nprod, unsigned ncons,
+	unsigned batch, int behavior, int mutex) {
+	struct bench_ctx ctx;
+	struct bench_thread th[BENCH_MAX_THREADS * 2];
+	unsigned i, flags = 0;
+	unsigned long nsample = 0;
+	uint64_t *all, t0, t1, c0, c1;
+	double secs;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.opt = opt;
+	ctx.nprod = nprod;
+	ctx.ncons = ncons;
+	ctx.batch = batch;
+	ctx.behavior = behavior;
+	ctx.total = opt->objs * nprod;
+	if (mutex) {
+		ctx.q = mutex_queue_create(opt->size);
+	} else {
+		if (nprod == 1)
+			flags |= RING_F_SP;
+		if (ncons == 1)
+			flags |= RING_F_SC;
+		if (opt->ring_numa) {
+			ctx.r = ring_create_numa(opt->size, flags, opt->ring_node);
+		} else {
+			ctx.r = bench_ring_alloc(ring_memsize(opt->size));
+			ring_init(ctx.r, opt->size, flags);
+		}
+	}
+	pthread_barrier_init(&ctx.start, NULL, nprod + ncons + 1);
+
+	for (i = 0; i < nprod + ncons; i++) {
+		th[i].ctx = &ctx;
+		th[i].nsample = 0;
+		th[i].samples = NULL;
+		if (i < nprod) {
+			th[i].cpu = bench_cpu(0, nprod, i);
+			pthread_create(&th[i].tid, NULL, bench_producer, &th[i]);
+		} else {
+			th[i].cpu = bench_cpu(1, nprod, i - nprod);
+			th[i].samples = malloc((ctx.total / (BENCH_SAMPLE_MASK + 1) + BENCH_MAX_BATCH) * sizeof(uint64_t));
+			pthread_create(&th[i].tid, NULL, bench_consumer, &th[i]);
+		}
+	}
+	pthread_barrier_wait(&ctx.start);
+	t0 = bench_ns();
+	c0 = bench_tsc();
+	for (i = 0; i < nprod + ncons; i++)
+		pthread_join(th[i].tid, NULL);
+	c1 = bench_tsc();
+	t1 = bench_ns();
+
+	for (i = nprod; i < nprod + ncons; i++)
+		nsample += th[i].nsample;
+	all = malloc((nsample + 1) * sizeof(uint64_t));
+	nsample = 0;
+	for (i = nprod; i < nprod + ncons; i++) {
+		memcpy(all + nsample, th[i].samples, th[i].nsample * sizeof(uint64_t));
+		nsample += th[i].nsample;
+		free(th[i].samples);
+	}
+	qsort(all, nsample, sizeof(uint64_t), bench_cmp);
+	if (nsample == 0)
+		all[0] = 0;
+
+	secs = (t1 - t0) / 1e9;
+	printf("%-6s %3u %3u %6u %-8s %10.2f %9.2f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+		mutex ? "mutex" : "ring", nprod, ncons, batch,
+		behavior == RING_B_FIXED ? "fixed" : "variable",
+		ctx.total / secs / 1e6, (double)(c1 - c0) / ctx.total,
+		all[nsample / 2], all[nsample * 99 / 100], all[nsample * 999 / 1000]);
+	fflush(stdout);
+
+	free(all);
+	pthread_barrier_destroy(&ctx.start);
+	if (mutex)
+		mutex_queue_free(ctx.q);
+	else if (opt->ring_numa)
+		ring_free_numa(ctx.r);
+	else
+		free(ctx.r);
+}
+
+static void
+bench_verify_fail(const struct bench_ctx *ctx, const char *what, uintptr_t v) {
+	fprintf(stderr, "verify: %s object producer %" PRIu64 " seq %" PRIu64 ", P %u C %u batch %u %s\n",
+		what, (uint64_t)v >> BENCH_SEQ_BITS, (uint64_t)v & (((uint64_t)1 << BENCH_SEQ_BITS) - 1),
+		ctx->nprod, ctx->ncons, ctx->batch, ctx->behavior == RING_B_FIXED ? "fixed" : "variable");
+	abort();
+}
+
+/* Push objs sequence numbers of the producer in random bursts. */
+static void *
+bench_verify_producer(void *arg) {
+	struct bench_thread *t = (struct bench_thread *)arg;
+	struct bench_ctx *ctx = t->ctx;
+	void *objs[BENCH_MAX_BATCH];
+	unsigned long seq = 0, left = ctx->opt->objs;
+	int rep = 0;
+
+	pthread_barrier_wait(&ctx->start);
+	while (left > 0) {
+		unsigned i, n = 1 + rand_r(&t->seed) % ctx->batch;
+
+		if (n > left)
+			n = (unsigned)left;
+		for (i = 0; i < n; i++)
+			objs[i] = (void *)(uintptr_t)((uint64_t)(t->id + 1) << BENCH_SEQ_BITS | seq++);
+		i = 0;
+		while (i < n) {
+			unsigned m = ring_push(ctx->r, objs + i, n - i, ctx->behavior);
+			if (m == 0) {
+				ring_pause();
+				if (++rep >= 64) {
+					rep = 0;
+					sched_yield();
+				}
+				continue;
+			}
+			i += m;
+		}
+		left -= n;
+	}
+	return NULL;
+}
+
+/**
+ * Pop in random bursts, sequence numbers of each producer must grow
+ * as one consumer sees them, and each object is seen once.
+ */
+static void *
+bench_verify_consumer(void *arg) {
+	struct bench_thread *t = (struct bench_thread *)arg;
+	struct bench_ctx *ctx = t->ctx;
+	void *objs[BENCH_MAX_BATCH];
+	uint64_t next[BENCH_MAX_THREADS] = {0};
+	const uint64_t per = ctx->opt->objs;
+	int rep = 0;
+
+	pthread_barrier_wait(&ctx->start);
+	for (;;) {
+		unsigned long left = ctx->total - __atomic_load_n(&ctx->popped, __ATOMIC_RELAXED);
+		unsigned i, n = 1 + rand_r(&t->seed) % ctx->batch;
+
+		if (left == 0) {
+			break;
+		}
+		n = ring_pop(ctx->r, objs, left < n ? (unsigned)left : n, ctx->behavior);
+		if (n == 0) {
+			ring_pause();
+			if (++rep >= 64) {
+				rep = 0;
+				sched_yield();
+			}
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			uintptr_t v = (uintptr_t)objs[i];
+			uint64_t id = ((uint64_t)v >> BENCH_SEQ_BITS) - 1;
+			uint64_t seq = (uint64_t)v & (((uint64_t)1 << BENCH_SEQ_BITS) - 1);
+
+			if (id >= ctx->nprod || seq >= per)
+				bench_verify_fail(ctx, "bad", v);
+			if (seq < next[id])
+				bench_verify_fail(ctx, "out of order", v);
+			next[id] = seq + 1;
+			if (__atomic_exchange_n(&ctx->seen[id * per + seq], 1, __ATOMIC_RELAXED))
+				bench_verify_fail(ctx, "duplicate", v);
+		}
+		__atomic_add_fetch(&ctx->popped, n, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/**
+ * Verify rounds of random producer/consumer counts, sync types, exact
+ * or power of 2 size, batch and behavior, abort on the first error.
+ */
+static void
+bench_verify(const struct bench_opt *opt) {
+#ifdef RING_INDEX64
+	/* No RTS/HTS sync with 64bit indexes. */
+	static const unsigned psync[] = {0, 0, 0};
+	static const unsigned csync[] = {0, 0, 0};
+#else
+	static const unsigned psync[] = {0, RING_F_MP_RTS, RING_F_MP_HTS};
+	static const unsigned csync[] = {0, RING_F_MC_RTS, RING_F_MC_HTS};
+#endif
+	struct bench_ctx ctx;
+	struct bench_thread th[BENCH_MAX_THREADS * 2];
+	unsigned round, i, count, cap, flags, seed = opt->seed;
+	unsigned long j;
+
+	printf("verify %u rounds, seed %u, objs %lu, index %zu bits, start index %#" PRIx64 "\n",
+		opt->verify, seed, opt->objs, sizeof(ring_idx_t) * 8, (uint64_t)(ring_idx_t)RING_INIT_INDEX);
+	for (round = 0; round < opt->verify; round++) {
+		memset(&ctx, 0, sizeof(ctx));
+		ctx.opt = opt;
+		ctx.nprod = 1 + rand_r(&seed) % opt->max_prod;
+		ctx.ncons = 1 + rand_r(&seed) % opt->max_cons;
+		ctx.behavior = rand_r(&seed) % 2 ? RING_B_VARIABLE : RING_B_FIXED;
+		ctx.total = opt->objs * ctx.nprod;
+		flags = psync[rand_r(&seed) % 3] | csync[rand_r(&seed) % 3];
+		if (ctx.nprod == 1 && rand_r(&seed) % 2)
+			flags |= RING_F_SP;
+		if (ctx.ncons == 1 && rand_r(&seed) % 2)
+			flags |= RING_F_SC;
+		count = opt->size;
+		if (rand_r(&seed) % 2) {
+			flags |= RING_F_EXACT_SZ;
+			count = opt->size / 2 + rand_r(&seed) % (opt->size / 2);
+			ctx.r = bench_ring_alloc(ring_exact_memsize(count));
+		} else {
+			ctx.r = bench_ring_alloc(ring_memsize(count));
+		}
+		ring_init(ctx.r, count, flags);
+		cap = ring_avail(ctx.r);
+		ctx.batch = 1 + rand_r(&seed) % (cap < BENCH_MAX_BATCH ? cap : BENCH_MAX_BATCH);
+		ctx.seen = calloc(ctx.total, 1);
+		pthread_barrier_init(&ctx.start, NULL, ctx.nprod + ctx.ncons);
+
+		for (i = 0; i < ctx.nprod + ctx.ncons; i++) {
+			th[i].ctx = &ctx;
+			th[i].id = i;
+			th[i].seed = rand_r(&seed);
+			pthread_create(&th[i].tid, NULL,
+				i < ctx.nprod ? bench_verify_producer : bench_verify_consumer, &th[i]);
+		}
+		for (i = 0; i < ctx.nprod + ctx.ncons; i++)
+			pthread_join(th[i].tid, NULL);
+
+		for (j = 0; j < ctx.total; j++) {
+			if (!ctx.seen[j])
+				bench_verify_fail(&ctx, "lost", (uintptr_t)((uint64_t)(j / opt->objs + 1) << BENCH_SEQ_BITS | j % opt->objs));
+		}
+		if (ring_count(ctx.r) != 0 || ring_avail(ctx.r) != cap) {
+			fprintf(stderr, "verify: ring not empty after round, count %u avail %u\n",
+				ring_count(ctx.r), ring_avail(ctx.r));
+			abort();
+		}
+		printf("round %u: P %u C %u size %u flags %#x batch %u %s ok\n",
+			round, ctx.nprod, ctx.ncons, count, flags, ctx.batch,
+			ctx.behavior == RING_B_FIXED ? "fixed" : "variable");
+		fflush(stdout);
+
+		pthread_barrier_destroy(&ctx.start);
+		free(ctx.seen);
+		free(ctx.r);
+	}
+}
+
+/**
+ * Cycles per object of the scalar and vector copy of 8 bytes objects
+ * by batch, in cache, to find RING_COPY_SIMD_MIN of the build.
+ */
+static void
+bench_copy(void) {
+	static void *src[4096], *dst[4096];
+	unsigned b, i, iters;
+	uint64_t t0, t1, t2;
+
+#if defined(__AVX512F__)
+	printf("vector copy: AVX-512\n");
+#elif defined(__AVX__)
+	printf("vector copy: AVX\n");
+#elif defined(__ARM_NEON)
+	printf("vector copy: NEON\n");
+#else
+	printf("vector copy: none, build with -mavx2 or -mavx512f\n");
+#endif
+	printf("%6s %7s %10s %10s\n", "batch", "bytes", "scalar", "vector");
+	for (b = 1; b <= 4096; b *= 2) {
+		iters = (1 << 24) / b;
+		t0 = bench_tsc();
+		for (i = 0; i < iters; i++) {
+			copy_scalar(dst, src, b, sizeof(void *));
+			asm volatile("" ::: "memory");
+		}
+		t1 = bench_tsc();
+		for (i = 0; i < iters; i++) {
+			copy_bulk((uint8_t *)dst, (const uint8_t *)src, b * sizeof(void *));
+			asm volatile("" ::: "memory");
+		}
+		t2 = bench_tsc();
+		printf("%6u %7zu %10.3f %10.3f\n", b, b * sizeof(void *),
+			(double)(t1 - t0) / ((double)iters * b), (double)(t2 - t1) / ((double)iters * b));
+	}
+}
+
+#define BENCH_PAD_SIZE 1024	/* Slots of the -P ring. */
+
+/* SPSC ring of -P, the producer and consumer indexes are dist bytes apart. */
+struct bench_pad {
+	uint32_t *ptail;
+	uint32_t *ctail;
+	void **slots;
+	struct ring *r;		/* SP/SC ring of the last row, padded by RING_CACHE_PAD. */
+	unsigned long objs;
+	int cpu[2];
+	pthread_barrier_t start;
+};
+
+static inline void
+bench_pad_pause(int *rep) {
+	ring_pause();
+	if (++*rep >= 64) {
+		*rep = 0;
+		sched_yield();
+	}
+}
+
+static void *
+bench_pad_producer(void *arg) {
+	struct bench_pad *b = (struct bench_pad *)arg;
+	uint32_t head = 0, cached = 0;
+	unsigned long i;
+	int rep = 0;
+
+	bench_pin(b->cpu[0]);
+	pthread_barrier_wait(&b->start);
+	for (i = 0; i < b->objs; i++) {
+		while (head - cached == BENCH_PAD_SIZE) {
+			cached = __atomic_load_n(b->ctail, __ATOMIC_ACQUIRE);
+			if (head - cached == BENCH_PAD_SIZE)
+				bench_pad_pause(&rep);
+		}
+		b->slots[head & (BENCH_PAD_SIZE - 1)] = (void *)(uintptr_t)(i + 1);
+		__atomic_store_n(b->ptail, ++head, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void *
+bench_pad_consumer(void *arg) {
+	struct bench_pad *b = (struct bench_pad *)arg;
+	uint32_t head = 0, cached = 0;
+	unsigned long i, sum = 0;
+	int rep = 0;
+
+	bench_pin(b->cpu[1]);
+	pthread_barrier_wait(&b->start);
+	for (i = 0; i < b->objs; i++) {
+		while (head == cached) {
+			cached = __atomic_load_n(b->ptail, __ATOMIC_ACQUIRE);
+			if (head == cached)
+				bench_pad_pause(&rep);
+		}
+		sum += (uintptr_t)b->slots[head & (BENCH_PAD_SIZE - 1)];
+		__atomic_store_n(b->ctail, ++head, __ATOMIC_RELEASE);
+	}
+	return (void *)sum;
+}
+
+static void *
+bench_pad_ring_producer(void *arg) {
+	struct bench_pad *b = (struct bench_pad *)arg;
+	unsigned long i;
+	void *obj;
+	int rep = 0;
+
+	bench_pin(b->cpu[0]);
+	pthread_barrier_wait(&b->start);
+	for (i = 0; i < b->objs; i++) {
+		obj = (void *)(uintptr_t)(i + 1);
+		while (ring_push(b->r, &obj, 1, RING_B_FIXED) == 0)
+			bench_pad_pause(&rep);
+	}
+	return NULL;
+}
+
+static void *
+bench_pad_ring_consumer(void *arg) {
+	struct bench_pad *b = (struct bench_pad *)arg;
+	unsigned long i, sum = 0;
+	void *obj;
+	int rep = 0;
+
+	bench_pin(b->cpu[1]);
+	pthread_barrier_wait(&b->start);
+	for (i = 0; i < b->objs; i++) {
+		while (ring_pop(b->r, &obj, 1, RING_B_FIXED) == 0)
+			bench_pad_pause(&rep);
+		sum += (uintptr_t)obj;
+	}
+	return (void *)sum;
+}
+
+/* Run a producer and a consumer of b, print a row of the -P table. */
+static void
+bench_pad_run(struct bench_pad *b, const char *name, void *(*producer)(void *),
+	void *(*consumer)(void *)) {
+	pthread_t tid[2];
+	uint64_t t0, t1, c0, c1;
+
+	pthread_barrier_init(&b->start, NULL, 3);
+	pthread_create(&tid[0], NULL, producer, b);
+	pthread_create(&tid[1], NULL, consumer, b);
+	pthread_barrier_wait(&b->start);
+	t0 = bench_ns();
+	c0 = bench_tsc();
+	pthread_join(tid[0], NULL);
+	pthread_join(tid[1], NULL);
+	c1 = bench_tsc();
+	t1 = bench_ns();
+	pthread_barrier_destroy(&b->start);
+	printf("%6s %10.2f %9.2f\n", name, b->objs / ((t1 - t0) / 1e9) / 1e6,
+		(double)(c1 - c0) / b->objs);
+	fflush(stdout);
+}
+
+/**
+ * SPSC throughput of one object handoffs by the distance between the
+ * producer and consumer indexes, in one line, adjacent lines and apart,
+ * to see what RING_CACHE_PAD buys on this machine. The last row is an
+ * SP/SC struct ring at batch 1, laid out by the RING_CACHE_PAD of the
+ * build.
+ */
+static void
+bench_pad(const struct bench_opt *opt) {
+	static const unsigned dist[] = {8, 64, 128, 256};
+	struct bench_pad b;
+	uint8_t *area;
+	char name[16];
+	unsigned i;
+
+	bench_cpu_setup(opt->numa);
+	if (posix_memalign((void **)&area, 4096, 4096) != 0
+		|| posix_memalign((void **)&b.slots, 4096, BENCH_PAD_SIZE * sizeof(void *)) != 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	b.objs = opt->objs;
+	b.cpu[0] = bench_cpu(0, 1, 0);
+	b.cpu[1] = bench_cpu(1, 1, 0);
+	printf("pad %d, objs %lu, producer cpu %d, consumer cpu %d\n",
+		RING_CACHE_PAD, opt->objs, b.cpu[0], b.cpu[1]);
+	printf("%6s %10s %9s\n", "dist", "Mops/s", "cyc/obj");
+	for (i = 0; i < sizeof(dist) / sizeof(dist[0]); i++) {
+		memset(area, 0, 4096);
+		b.ptail = (uint32_t *)area;
+		b.ctail = (uint32_t *)(area + dist[i]);
+		snprintf(name, sizeof(name), "%u", dist[i]);
+		bench_pad_run(&b, name, bench_pad_producer, bench_pad_consumer);
+	}
+	b.r = bench_ring_alloc(ring_memsize(BENCH_PAD_SIZE));
+	ring_init(b.r, BENCH_PAD_SIZE, RING_F_SP | RING_F_SC);
+	bench_pad_run(&b, "ring", bench_pad_ring_producer, bench_pad_ring_consumer);
+	free(b.r);
+	free(b.slots);
+	free(area);
+}
+
+static void
+usage(const char *name) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -s size     ring size, power of 2 (default 1024)\n"
+		"  -n objs     objects pushed by each producer (default 1000000)\n"
+		"  -p max      max producers, sweep 1,2,4.. (default 4)\n"
+		"  -c max      max consumers, sweep 1,2,4.. (default 4)\n"
+		"  -b list     batch sizes (default 1,8,32,256)\n"
+		"  -m          run mutex queue baseline too\n"
+		"  -N          producers on numa node 0, consumers on node 1\n"
+		"  -r node     ring memory bound to numa node (-1 local policy)\n"
+		"  -x          scalar/vector copy crossover, then exit\n"
+		"  -P          SPSC throughput by producer/consumer index distance, then exit\n"
+		"  -V rounds   verify order and loss with random threads and bursts, then exit\n"
+		"  -S seed     random seed of -V (default time)\n",
+		name);
+}
+
+int
+main(int argc, char *argv[]) {
+	struct bench_opt opt;
+	unsigned p, c, b;
+	int ch, behavior;
+	char *s;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.size = 1024;
+	opt.objs = 1000000;
+	opt.max_prod = 4;
+	opt.max_cons = 4;
+	opt.seed = (unsigned)time(NULL);
+	while ((ch = getopt(argc, argv, "s:n:p:c:b:mNr:xPV:S:h")) != -1) {
+		switch (ch) {
+		case 's':
+			opt.size = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			opt.objs = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			opt.max_prod = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			opt.max_cons = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			for (s = optarg; *s && opt.nbatch < 8; ) {
+				opt.batches[opt.nbatch++] = strtoul(s, &s, 10);
+				if (*s == ',')
+					s++;
+			}
+			break;
+		case 'm':
+			opt.mutex = 1;
+			break;
+		case 'N':
+			opt.numa = 1;
+			break;
+		case 'r':
+			opt.ring_numa = 1;
+			opt.ring_node = atoi(optarg);
+			break;
+		case 'x':
+			bench_copy();
+			return 0;
+		case 'P':
+			opt.pad = 1;
+			break;
+		case 'V':
+			opt.verify = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			opt.seed = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (opt.nbatch == 0) {
+		opt.batches[0] = 1;
+		opt.batches[1] = 8;
+		opt.batches[2] = 32;
+		opt.batches[3] = 256;
+		opt.nbatch = 4;
+	}
+	if (ring_memsize(opt.size) == 0 || opt.max_prod == 0 || opt.max_cons == 0
+		|| opt.max_prod > BENCH_MAX_THREADS || opt.max_cons > BENCH_MAX_THREADS) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (opt.pad) {
+		bench_pad(&opt);
+		return 0;
+	}
+	if (opt.verify) {
+		if (opt.size < 4) {
+			usage(argv[0]);
+			return 1;
+		}
+		bench_verify(&opt);
+		return 0;
+	}
+	for (b = 0; b < opt.nbatch; b++) {
+		if (opt.batches[b] == 0 || opt.batches[b] > BENCH_MAX_BATCH || opt.batches[b] >= opt.size) {
+			fprintf(stderr, "batch size must be in 1..%d and less than ring size\n", BENCH_MAX_BATCH);
+			return 1;
+		}
+	}
+	bench_cpu_setup(opt.numa);
+	if (opt.ring_numa) {
+		struct ring *r = ring_create_numa(opt.size, 0, opt.ring_node);
+
+		if (!r) {
+			fprintf(stderr, "ring on numa node %d: %s\n", opt.ring_node, strerror(errno));
+			return 1;
+		}
+		printf("ring data on numa node %d\n", ring_numa_node(r));
+		ring_free_numa(r);
+	}
+
+	printf("size %u, objs %lu, cpus %d, index %zu bits, latency in tsc ticks\n",
+		opt.size, opt.objs, bench_ncpu, sizeof(ring_idx_t) * 8);
+	printf("pad %d, prod at %zu, cons at %zu, data at %zu\n", RING_CACHE_PAD,
+		offsetof(struct ring, prod), offsetof(struct ring, cons), offsetof(struct ring, ring));
+	printf("%-6s %3s %3s %6s %-8s %10s %9s %10s %10s %10s\n",
+		"queue", "P", "C", "batch", "behavior", "Mops/s", "cyc/obj", "p50", "p99", "p999");
+	for (p = 1; p <= opt.max_prod; p *= 2) {
+		for (c = 1; c <= opt.max_cons; c *= 2) {
+			for (b = 0; b < opt.nbatch; b++) {
+				for (behavior = RING_B_FIXED; behavior <= RING_B_VARIABLE; behavior++) {
+					bench_run(&opt, p, c, opt.batches[b], behavior, 0);
+					if (opt.mutex)
+						bench_run(&opt, p, c, opt.batches[b], behavior, 1);
+				}
+			}
+		}
+	}
+	return 0;
+}
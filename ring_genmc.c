@@ -0,0 +1,127 @@
+/**
+ * Model checker driver of ring, for GenMC.
+ *
+ * genmc -unroll=4 -- -DRING_INIT_INDEX=0xfffffffe -I. ring_genmc.c
+ *
+ * Two producers push GENMC_OBJS objects each on a 4 slots ring, two
+ * consumers pop, all orders of the threads are explored under the
+ * memory model (RC11 by default, -imm for IMM). Each object must be
+ * popped once and the objects of a producer in order by a consumer.
+ * RING_INIT_INDEX crosses the 32bit index wraparound in the run.
+ * Add -DGENMC_FLAGS='RING_F_MP_RTS|RING_F_MC_RTS' or
+ * -DGENMC_FLAGS='RING_F_MP_HTS|RING_F_MC_HTS' to check RTS/HTS sync.
+ * It also builds as a plain pthread test:
+ * cc -O1 -pthread -DRING_INIT_INDEX=0xfffffffe -o ring_genmc ring_genmc.c
+ */
+
+#define RING_MODEL_CHECK 1
+#define RING_ASSERT(x) assert(x)
+#define RING_IMPLEMENTATION
+#include <assert.h>
+#include "ring.h"
+
+#include <pthread.h>
+
+#ifndef GENMC_FLAGS
+#define GENMC_FLAGS 0
+#endif
+
+#define GENMC_COUNT 4	/* Slots of the ring, holds 3 objects. */
+#define GENMC_OBJS 2	/* Objects pushed by a producer. */
+#define GENMC_TRIES 2	/* Push/pop tries of a thread, bounded for the checker. */
+#define GENMC_THREADS 2	/* Producers, and as many consumers. */
+
+static union {
+	struct ring r;
+	uint8_t mem[sizeof(struct ring) + GENMC_COUNT * sizeof(void *)];
+} genmc_ring;
+
+/* Objects pushed by a producer, popped by a consumer. */
+static unsigned genmc_pushed[GENMC_THREADS];
+static uintptr_t genmc_popped[GENMC_THREADS][GENMC_THREADS * GENMC_OBJS];
+static unsigned genmc_npopped[GENMC_THREADS];
+
+/* Object is the producer id << 8 | seq, 0 is never pushed. */
+#define GENMC_OBJ(id,seq) ((uintptr_t)((id) + 1) << 8 | (seq))
+
+/**
+ * Check obj is popped once and after the previous object of its
+ * producer in the run of pops last[] is kept for.
+ */
+static void
+genmc_check(uintptr_t obj, unsigned *seen, unsigned *last) {
+	unsigned p = (unsigned)(obj >> 8) - 1, seq = (unsigned)(obj & 0xff);
+
+	assert(p < GENMC_THREADS && seq < GENMC_OBJS);
+	assert(!(seen[p] & (1u << seq)));
+	assert(seq + 1 > last[p]);
+	seen[p] |= 1u << seq;
+	last[p] = seq + 1;
+}
+
+static void *
+genmc_producer(void *arg) {
+	unsigned id = (unsigned)(uintptr_t)arg, seq, t;
+	void *obj;
+
+	for (seq = 0; seq < GENMC_OBJS; seq++) {
+		obj = (void *)GENMC_OBJ(id, seq);
+		for (t = 0; t < GENMC_TRIES; t++) {
+			if (ring_push(&genmc_ring.r, &obj, 1, RING_B_FIXED) == 1)
+				break;
+		}
+		/* Full, no later object of the producer is pushed. */
+		if (t == GENMC_TRIES)
+			break;
+		genmc_pushed[id]++;
+	}
+	return NULL;
+}
+
+static void *
+genmc_consumer(void *arg) {
+	unsigned id = (unsigned)(uintptr_t)arg, t;
+	void *obj;
+
+	for (t = 0; t < GENMC_TRIES; t++) {
+		if (ring_pop(&genmc_ring.r, &obj, 1, RING_B_FIXED) == 1)
+			genmc_popped[id][genmc_npopped[id]++] = (uintptr_t)obj;
+	}
+	return NULL;
+}
+
+int
+main(void) {
+	pthread_t prod[GENMC_THREADS], cons[GENMC_THREADS];
+	unsigned seen[GENMC_THREADS] = {0}, last[GENMC_THREADS], i, j, p, n;
+	void *rest[GENMC_COUNT];
+
+	ring_init(&genmc_ring.r, GENMC_COUNT, GENMC_FLAGS);
+	for (i = 0; i < GENMC_THREADS; i++) {
+		pthread_create(&prod[i], NULL, genmc_producer, (void *)(uintptr_t)i);
+		pthread_create(&cons[i], NULL, genmc_consumer, (void *)(uintptr_t)i);
+	}
+	for (i = 0; i < GENMC_THREADS; i++) {
+		pthread_join(prod[i], NULL);
+		pthread_join(cons[i], NULL);
+	}
+
+	/* Each consumer pops the objects of a producer in order. */
+	for (i = 0; i < GENMC_THREADS; i++) {
+		for (p = 0; p < GENMC_THREADS; p++)
+			last[p] = 0;
+		for (j = 0; j < genmc_npopped[i]; j++)
+			genmc_check(genmc_popped[i][j], seen, last);
+	}
+
+	/* The rest is left in the ring in order, nothing lost or popped twice. */
+	for (p = 0; p < GENMC_THREADS; p++)
+		last[p] = 0;
+	n = ring_pop(&genmc_ring.r, rest, GENMC_COUNT, RING_B_VARIABLE);
+	for (j = 0; j < n; j++)
+		genmc_check((uintptr_t)rest[j], seen, last);
+	for (p = 0; p < GENMC_THREADS; p++)
+		assert(seen[p] == (1u << genmc_pushed[p]) - 1);
+	assert(ring_empty(&genmc_ring.r));
+	return 0;
+}
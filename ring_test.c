@@ -0,0 +1,1605 @@
+/**
+ * Behavior tests of the ring API.
+ *
+ * cc -O1 -g -pthread '-DRING_ASSERT(x)=((x) ? (void)0 : abort())' -o ring_test ring_test.c
+ * ./ring_test
+ *
+ * Each test checks the data popped against what was pushed, and the
+ * edge cases of its API (full, empty, fixed and variable batches).
+ * Rings start at RING_INIT_INDEX near the 32bit index wraparound, so
+ * the tests cross it. Build with -fsanitize=thread to check the races
+ * of the threaded tests too.
+ */
+
+#define _GNU_SOURCE
+#ifndef RING_INIT_INDEX
+#define RING_INIT_INDEX 0xffffff00
+#endif
+#define RING_IMPLEMENTATION
+#include "ring.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#define TEST_ROUNDS 2000	/* Push/pop rounds of the single thread tests. */
+#define TEST_OBJS 200000	/* Objects of a producer in the threaded tests. */
+
+/* Memory aligned to RING_CACHE_PAD, as the padded structs expect. */
+static void *
+test_alloc(size_t sz) {
+	void *p;
+
+	assert(sz > 0);
+	if (posix_memalign(&p, RING_CACHE_PAD, sz) != 0)
+		abort();
+	memset(p, 0xa5, sz);
+	return p;
+}
+
+/* Fill an element of esize bytes from its sequence number. */
+static void
+test_fill(uint8_t *e, uint32_t esize, uint32_t seq) {
+	uint32_t i;
+
+	for (i = 0; i < esize; i += 4) {
+		uint32_t v = seq * 2654435761u + i;
+
+		memcpy(e + i, &v, 4);
+	}
+}
+
+static void
+test_check(const uint8_t *e, uint32_t esize, uint32_t seq) {
+	uint8_t want[256];
+
+	test_fill(want, esize, seq);
+	assert(memcmp(e, want, esize) == 0);
+}
+
+/* Push and pop batches of an element ring, FIFO and counts checked. */
+static void
+test_elem_ring(unsigned count, unsigned esize, unsigned flags) {
+	static uint8_t in[64 * 256], out[64 * 256];
+	size_t sz = (flags & RING_F_EXACT_SZ) ? ring_elem_exact_memsize(count, esize)
+		: ring_elem_memsize(count, esize);
+	struct ring *r = (struct ring *)test_alloc(sz);
+	uint32_t pushed = 0, popped = 0, round, cap, n, k, i, left;
+
+	ring_elem_init(r, count, esize, flags);
+	cap = ring_avail(r);
+	assert(cap == ((flags & RING_F_EXACT_SZ) ? count : count - 1));
+	assert(ring_empty(r) && !ring_full(r) && ring_count(r) == 0);
+
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		n = 1 + round % 64;
+		for (i = 0; i < n; i++)
+			test_fill(in + i * esize, esize, pushed + i);
+		if (round & 1) {
+			k = ring_elem_push_burst(r, in, n, &left);
+			assert(k == (n < cap - (pushed - popped) ? n : cap - (pushed - popped)));
+			/* A single producer counts from its cached tail, may be less. */
+			assert(left <= cap - (pushed - popped) - k);
+			assert((flags & RING_F_SP) || left == cap - (pushed - popped) - k);
+		} else {
+			k = ring_elem_push(r, in, n, RING_B_FIXED);
+			assert(k == (n <= cap - (pushed - popped) ? n : 0));
+		}
+		pushed += k;
+		assert(ring_count(r) == pushed - popped);
+		assert(ring_full(r) == (pushed - popped == cap));
+
+		n = 1 + (round * 7) % 64;
+		if (round & 2) {
+			k = ring_elem_pop_burst(r, out, n, &left);
+			assert(k == (n < pushed - popped ? n : pushed - popped));
+			assert(left <= pushed - popped - k);
+			assert((flags & RING_F_SC) || left == pushed - popped - k);
+		} else {
+			k = ring_elem_pop(r, out, n, RING_B_FIXED);
+			assert(k == (n <= pushed - popped ? n : 0));
+		}
+		for (i = 0; i < k; i++)
+			test_check(out + i * esize, esize, popped + i);
+		popped += k;
+	}
+	k = ring_elem_pop(r, out, pushed - popped, RING_B_VARIABLE);
+	for (i = 0; i < k; i++)
+		test_check(out + i * esize, esize, popped + i);
+	popped += k;
+	assert(popped == pushed && ring_empty(r));
+	free(r);
+}
+
+/* Consecutive elements of a scrambled ring sit on different lines. */
+static void
+test_elem_scramble(void) {
+	struct ring *r = (struct ring *)test_alloc(ring_elem_memsize(128, 8));
+	uint8_t in[16], out[16], *ring;
+	unsigned i, slot[2] = {128, 128};
+
+	ring_elem_init(r, 128, 8, RING_F_SP | RING_F_SC | RING_F_SCRAMBLE);
+	ring = (uint8_t *)r->ring;
+	memset(ring, 0, 128 * 8);
+	test_fill(in, 8, 1);
+	test_fill(in + 8, 8, 2);
+	assert(ring_elem_push(r, in, 2, RING_B_FIXED) == 2);
+	for (i = 0; i < 128; i++) {
+		if (memcmp(ring + i * 8, in, 8) == 0)
+			slot[0] = i;
+		else if (memcmp(ring + i * 8, in + 8, 8) == 0)
+			slot[1] = i;
+	}
+	assert(slot[0] < 128 && slot[1] < 128);
+	assert(slot[0] / (CACHE_LINE_SIZE / 8) != slot[1] / (CACHE_LINE_SIZE / 8));
+	/* Pops read back through the consumer geometry. */
+	assert(ring_elem_pop(r, out, 2, RING_B_FIXED) == 2);
+	test_check(out, 8, 1);
+	test_check(out + 8, 8, 2);
+	free(r);
+}
+
+static void
+test_elem(void) {
+	static const unsigned esizes[] = {4, 8, 12, 16, 20, 32, 40, 64, 256};
+	unsigned i;
+
+	assert(ring_elem_memsize(3, 8) == 0);
+	assert(ring_elem_memsize(64, 6) == 0);
+	assert(ring_elem_memsize(64, 0) == 0);
+	assert(ring_elem_exact_memsize(0, 8) == 0);
+	assert(ring_elem_exact_memsize(100, 8) == ring_elem_memsize(128, 8));
+#ifndef RING_INDEX64
+	/* The real cap of exact rings is 2^27, as 2^28 > RING_SIZE_MAX. */
+	assert(ring_elem_exact_memsize(1u << 27, 4) == ring_elem_memsize(1u << 27, 4));
+	assert(ring_elem_exact_memsize((1u << 27) + 1, 4) == 0);
+	assert(ring_exact_memsize(RING_SIZE_MAX) == 0);
+#endif
+	for (i = 0; i < sizeof(esizes) / sizeof(esizes[0]); i++) {
+		test_elem_ring(64, esizes[i], 0);
+		test_elem_ring(64, esizes[i], RING_F_SP | RING_F_SC);
+		test_elem_ring(100, esizes[i], RING_F_EXACT_SZ);
+		test_elem_ring(128, esizes[i], RING_F_SP | RING_F_SC | RING_F_SCRAMBLE);
+	}
+	test_elem_scramble();
+	printf("elem ok\n");
+}
+
+/* Threaded element ring of 16 bytes, producer id, sequence and check. */
+struct test_mt {
+	struct ring *r;
+	unsigned nprod;
+	unsigned batch;		/* Max batch of a push, at most the capacity. */
+	unsigned long popped;
+	unsigned char *seen;
+};
+
+struct test_mt_elem {
+	uint32_t id;
+	uint32_t seq;
+	uint64_t sum;
+};
+
+static void *
+test_mt_producer(void *arg) {
+	struct test_mt *t = (struct test_mt *)((void **)arg)[0];
+	uint32_t id = (uint32_t)(uintptr_t)((void **)arg)[1], seq = 0, n, i;
+	struct test_mt_elem e[8];
+
+	while (seq < TEST_OBJS) {
+		n = 1 + seq % t->batch;
+		if (n > TEST_OBJS - seq)
+			n = TEST_OBJS - seq;
+		for (i = 0; i < n; i++) {
+			e[i].id = id;
+			e[i].seq = seq + i;
+			e[i].sum = ((uint64_t)id << 32) + seq + i;
+		}
+		n = ring_elem_push(t->r, e, n, (seq & 1) ? RING_B_VARIABLE : RING_B_FIXED);
+		if (n == 0)
+			sched_yield();
+		seq += n;
+	}
+	return NULL;
+}
+
+static void *
+test_mt_consumer(void *arg) {
+	struct test_mt *t = (struct test_mt *)((void **)arg)[0];
+	uint32_t next[8] = {0}, n, i;
+	struct test_mt_elem e[8];
+	const unsigned long total = (unsigned long)t->nprod * TEST_OBJS;
+
+	while (__atomic_load_n(&t->popped, __ATOMIC_RELAXED) < total) {
+		n = ring_elem_pop(t->r, e, 1 + next[0] % 8, RING_B_VARIABLE);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			assert(e[i].id < t->nprod && e[i].seq < TEST_OBJS);
+			assert(e[i].sum == ((uint64_t)e[i].id << 32) + e[i].seq);
+			assert(e[i].seq >= next[e[i].id]);
+			next[e[i].id] = e[i].seq + 1;
+			assert(!__atomic_exchange_n(&t->seen[e[i].id * TEST_OBJS + e[i].seq], 1, __ATOMIC_RELAXED));
+		}
+		__atomic_add_fetch(&t->popped, n, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/* nprod producers and ncons consumers on an element ring of flags. */
+static void
+test_mt_run(unsigned count, unsigned nprod, unsigned ncons, unsigned flags) {
+	struct test_mt t;
+	pthread_t tid[8];
+	void *args[8][2];
+	unsigned i;
+
+	t.r = (struct ring *)test_alloc(ring_elem_memsize(count, sizeof(struct test_mt_elem)));
+	t.nprod = nprod;
+	t.batch = count - 1 < 8 ? count - 1 : 8;
+	t.popped = 0;
+	t.seen = (unsigned char *)calloc((size_t)nprod * TEST_OBJS, 1);
+	assert(t.seen);
+	ring_elem_init(t.r, count, sizeof(struct test_mt_elem), flags);
+	for (i = 0; i < nprod + ncons; i++) {
+		args[i][0] = &t;
+		args[i][1] = (void *)(uintptr_t)i;
+		pthread_create(&tid[i], NULL, i < nprod ? test_mt_producer : test_mt_consumer, args[i]);
+	}
+	for (i = 0; i < nprod + ncons; i++)
+		pthread_join(tid[i], NULL);
+	for (i = 0; i < nprod * TEST_OBJS; i++)
+		assert(t.seen[i]);
+	assert(ring_empty(t.r));
+	free(t.seen);
+	free(t.r);
+}
+
+static void
+test_elem_mt(void) {
+	test_mt_run(64, 1, 1, RING_F_SP | RING_F_SC);
+	test_mt_run(64, 2, 2, 0);
+	test_mt_run(128, 2, 2, RING_F_SCRAMBLE);
+#ifndef RING_INDEX64
+	test_mt_run(64, 2, 2, RING_F_MP_RTS | RING_F_MC_RTS);
+	test_mt_run(64, 2, 2, RING_F_MP_HTS | RING_F_MC_HTS);
+	/* Under 8 slots, RTS keeps a head/tail distance of 1. */
+	test_mt_run(4, 3, 3, RING_F_MP_RTS | RING_F_MC_RTS);
+#endif
+	printf("elem mt ok\n");
+}
+
+/* Element i of the zero copy spans of zcd. */
+static uint8_t *
+test_zc_elem(const struct ring_zc_data *zcd, unsigned i, unsigned esize) {
+	if (i < zcd->n1)
+		return (uint8_t *)zcd->ptr1 + (size_t)i * esize;
+	assert(zcd->ptr2);
+	return (uint8_t *)zcd->ptr2 + (size_t)(i - zcd->n1) * esize;
+}
+
+/* Zero copy push/pop rounds, finish with fewer than reserved at times. */
+static void
+test_zc_ring(unsigned count, unsigned esize, unsigned flags) {
+	struct ring *r = (struct ring *)test_alloc(ring_elem_memsize(count, esize));
+	struct ring_zc_data zcd;
+	uint32_t pushed = 0, popped = 0, round, cap = count - 1, n, k, fin, i, wraps = 0;
+
+	ring_elem_init(r, count, esize, flags);
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		n = 1 + round % 40;
+		k = ring_push_start(r, n, (round & 1) ? RING_B_VARIABLE : RING_B_FIXED, &zcd);
+		if (round & 1)
+			assert(k == (n < cap - (pushed - popped) ? n : cap - (pushed - popped)));
+		else
+			assert(k == (n <= cap - (pushed - popped) ? n : 0));
+		if (k) {
+			assert(zcd.n1 <= k && (zcd.n1 == k) == (zcd.ptr2 == NULL));
+			wraps += zcd.ptr2 != NULL;
+			/* Give back the last slot at times. */
+			fin = (round % 3 == 0) ? k - 1 : k;
+			for (i = 0; i < fin; i++)
+				test_fill(test_zc_elem(&zcd, i, esize), esize, pushed + i);
+			ring_push_finish(r, fin);
+			pushed += fin;
+		}
+		assert(ring_count(r) == pushed - popped);
+
+		n = 1 + (round * 5) % 40;
+		k = ring_pop_start(r, n, (round & 2) ? RING_B_VARIABLE : RING_B_FIXED, &zcd);
+		if (round & 2)
+			assert(k == (n < pushed - popped ? n : pushed - popped));
+		else
+			assert(k == (n <= pushed - popped ? n : 0));
+		if (k) {
+			fin = (round % 5 == 0) ? k / 2 : k;
+			for (i = 0; i < k; i++)
+				test_check(test_zc_elem(&zcd, i, esize), esize, popped + i);
+			ring_pop_finish(r, fin);
+			popped += fin;
+		}
+		assert(ring_count(r) == pushed - popped);
+	}
+	assert(wraps > 0);
+	free(r);
+}
+
+static void
+test_zc(void) {
+	struct ring *r = (struct ring *)test_alloc(ring_elem_memsize(64, 8));
+	struct ring_zc_data zcd;
+
+	/* Multi thread and scrambled rings have no zero copy. */
+	ring_elem_init(r, 64, 8, 0);
+	assert(ring_push_start(r, 1, RING_B_FIXED, &zcd) == 0);
+	assert(ring_pop_start(r, 1, RING_B_FIXED, &zcd) == 0);
+	ring_elem_init(r, 64, 8, RING_F_SP | RING_F_SC | RING_F_SCRAMBLE);
+	assert(ring_push_start(r, 1, RING_B_FIXED, &zcd) == 0);
+	free(r);
+
+	test_zc_ring(64, 8, RING_F_SP | RING_F_SC);
+	test_zc_ring(64, 12, RING_F_SP | RING_F_SC);
+	test_zc_ring(32, 64, RING_F_SP | RING_F_SC);
+#ifndef RING_INDEX64
+	test_zc_ring(64, 8, RING_F_MP_HTS | RING_F_MC_HTS);
+	test_zc_ring(64, 20, RING_F_SP | RING_F_MC_HTS);
+#endif
+	printf("zc ok\n");
+}
+
+#ifndef RING_INDEX64
+/* Two producers and two consumers zero copy on a HTS ring. */
+static void *
+test_zc_producer(void *arg) {
+	struct test_mt *t = (struct test_mt *)((void **)arg)[0];
+	uint32_t id = (uint32_t)(uintptr_t)((void **)arg)[1], seq = 0, n, i;
+	struct ring_zc_data zcd;
+
+	while (seq < TEST_OBJS) {
+		n = 1 + seq % t->batch;
+		if (n > TEST_OBJS - seq)
+			n = TEST_OBJS - seq;
+		n = ring_push_start(t->r, n, RING_B_VARIABLE, &zcd);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			struct test_mt_elem *e = (struct test_mt_elem *)test_zc_elem(&zcd, i, sizeof(*e));
+
+			e->id = id;
+			e->seq = seq + i;
+			e->sum = ((uint64_t)id << 32) + seq + i;
+		}
+		ring_push_finish(t->r, n);
+		seq += n;
+	}
+	return NULL;
+}
+
+static void *
+test_zc_consumer(void *arg) {
+	struct test_mt *t = (struct test_mt *)((void **)arg)[0];
+	const unsigned long total = (unsigned long)t->nprod * TEST_OBJS;
+	uint32_t next[8] = {0}, n, i;
+	struct ring_zc_data zcd;
+
+	while (__atomic_load_n(&t->popped, __ATOMIC_RELAXED) < total) {
+		n = ring_pop_start(t->r, 8, RING_B_VARIABLE, &zcd);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			const struct test_mt_elem *e = (const struct test_mt_elem *)test_zc_elem(&zcd, i, sizeof(*e));
+
+			assert(e->id < t->nprod && e->seq < TEST_OBJS);
+			assert(e->sum == ((uint64_t)e->id << 32) + e->seq);
+			assert(e->seq >= next[e->id]);
+			next[e->id] = e->seq + 1;
+			assert(!__atomic_exchange_n(&t->seen[e->id * TEST_OBJS + e->seq], 1, __ATOMIC_RELAXED));
+		}
+		ring_pop_finish(t->r, n);
+		__atomic_add_fetch(&t->popped, n, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void
+test_zc_mt(void) {
+	struct test_mt t;
+	pthread_t tid[4];
+	void *args[4][2];
+	unsigned i;
+
+	t.r = (struct ring *)test_alloc(ring_elem_memsize(64, sizeof(struct test_mt_elem)));
+	t.nprod = 2;
+	t.batch = 8;
+	t.popped = 0;
+	t.seen = (unsigned char *)calloc(2 * TEST_OBJS, 1);
+	assert(t.seen);
+	ring_elem_init(t.r, 64, sizeof(struct test_mt_elem), RING_F_MP_HTS | RING_F_MC_HTS);
+	for (i = 0; i < 4; i++) {
+		args[i][0] = &t;
+		args[i][1] = (void *)(uintptr_t)i;
+		pthread_create(&tid[i], NULL, i < 2 ? test_zc_producer : test_zc_consumer, args[i]);
+	}
+	for (i = 0; i < 4; i++)
+		pthread_join(tid[i], NULL);
+	for (i = 0; i < 2 * TEST_OBJS; i++)
+		assert(t.seen[i]);
+	assert(ring_empty(t.r));
+	free(t.seen);
+	free(t.r);
+	printf("zc mt ok\n");
+}
+#endif
+
+/* Peek and commit fewer than peeked at times, FIFO checked. */
+static void
+test_peek_ring(unsigned esize, unsigned flags) {
+	static uint8_t out[20 * 64], again[20 * 64];
+	struct ring *r = (struct ring *)test_alloc(ring_elem_memsize(64, esize));
+	uint32_t pushed = 0, popped = 0, round, n, k, c, i;
+
+	ring_elem_init(r, 64, esize, flags);
+	assert(ring_elem_peek(r, out, 1) == 0);
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		n = 1 + round % 16;
+		if (n <= 63 - (pushed - popped)) {
+			for (i = 0; i < n; i++)
+				test_fill(out + i * esize, esize, pushed + i);
+			assert(ring_elem_push(r, out, n, RING_B_FIXED) == n);
+			pushed += n;
+		}
+		n = 1 + round * 7 % 20;
+		k = ring_elem_peek(r, out, n);
+		assert(k == (n < pushed - popped ? n : pushed - popped));
+		for (i = 0; i < k; i++)
+			test_check(out + i * esize, esize, popped + i);
+		/* Peeked entries stay in the ring. */
+		assert(ring_count(r) == pushed - popped);
+		assert(ring_elem_peek(r, again, n) == k && memcmp(out, again, (size_t)k * esize) == 0);
+		c = (round % 3 == 0) ? k / 2 : k;
+		ring_pop_commit(r, c);
+		popped += c;
+		assert(ring_count(r) == pushed - popped);
+	}
+	free(r);
+}
+
+static void *
+test_peek_consumer(void *arg) {
+	struct test_mt *t = (struct test_mt *)((void **)arg)[0];
+	const unsigned long total = (unsigned long)t->nprod * TEST_OBJS;
+	uint32_t next[8] = {0}, n, i;
+	struct test_mt_elem e[8];
+
+	while (t->popped < total) {
+		n = ring_elem_peek(t->r, e, 1 + t->popped % 8);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		/* Commit one less at times, it is peeked again next. */
+		if (n > 1 && (t->popped & 1))
+			n--;
+		for (i = 0; i < n; i++) {
+			assert(e[i].id < t->nprod && e[i].seq == next[e[i].id]);
+			assert(e[i].sum == ((uint64_t)e[i].id << 32) + e[i].seq);
+			next[e[i].id]++;
+		}
+		ring_pop_commit(t->r, n);
+		t->popped += n;
+	}
+	return NULL;
+}
+
+static void
+test_peek(void) {
+	struct ring *r = (struct ring *)test_alloc(ring_memsize(64));
+	struct test_mt t;
+	pthread_t tid[3];
+	void *args[3][2], *objs[8];
+	uint32_t i, round, seq = 0;
+
+	/* Only single consumer rings peek. */
+	ring_init(r, 64, 0);
+	assert(ring_push(r, objs, 1, RING_B_FIXED) == 1);
+	assert(ring_peek(r, objs, 1) == 0);
+
+	/* Pointers ring, across the wraparound. */
+	ring_init(r, 64, RING_F_SP | RING_F_SC);
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		for (i = 0; i < 8; i++)
+			objs[i] = (void *)(uintptr_t)(seq + i);
+		assert(ring_push(r, objs, 8, RING_B_FIXED) == 8);
+		assert(ring_peek(r, objs, 8) == 8);
+		for (i = 0; i < 8; i++)
+			assert(objs[i] == (void *)(uintptr_t)(seq + i));
+		ring_pop_commit(r, 8);
+		seq += 8;
+	}
+	assert(ring_empty(r));
+	free(r);
+
+	test_peek_ring(4, RING_F_SP | RING_F_SC);
+	test_peek_ring(12, RING_F_SC);
+	test_peek_ring(64, RING_F_SP | RING_F_SC | RING_F_SCRAMBLE);
+
+	/* Two producers, a peeking consumer. */
+	t.r = (struct ring *)test_alloc(ring_elem_memsize(64, sizeof(struct test_mt_elem)));
+	t.nprod = 2;
+	t.batch = 8;
+	t.popped = 0;
+	t.seen = NULL;
+	ring_elem_init(t.r, 64, sizeof(struct test_mt_elem), RING_F_SC);
+	for (i = 0; i < 3; i++) {
+		args[i][0] = &t;
+		args[i][1] = (void *)(uintptr_t)i;
+		pthread_create(&tid[i], NULL, i < 2 ? test_mt_producer : test_peek_consumer, args[i]);
+	}
+	for (i = 0; i < 3; i++)
+		pthread_join(tid[i], NULL);
+	assert(t.popped == 2 * TEST_OBJS && ring_empty(t.r));
+	free(t.r);
+	printf("peek ok\n");
+}
+
+/* Producer threads of a ring set, one SP ring each. */
+struct test_set {
+	struct ring_set *set;
+	unsigned nprod;
+};
+
+/* Objects of the set tests, producer id in the top bits. */
+#define TEST_SET_OBJ(id,seq) ((void *)(((uintptr_t)(id) << 24 | (seq)) + 1))
+
+static void *
+test_set_producer(void *arg) {
+	struct test_set *t = (struct test_set *)((void **)arg)[0];
+	uint32_t id = (uint32_t)(uintptr_t)((void **)arg)[1], seq = 0, n, i;
+	void *objs[4];
+
+	while (seq < TEST_OBJS) {
+		n = 1 + seq % 4;
+		if (n > TEST_OBJS - seq)
+			n = TEST_OBJS - seq;
+		for (i = 0; i < n; i++)
+			objs[i] = TEST_SET_OBJ(id, seq + i);
+		/* Odd producers push directly and mark after. */
+		if (id & 1) {
+			n = ring_push(t->set->members[id].r, objs, n, RING_B_VARIABLE);
+			if (n)
+				ring_set_mark(t->set, id);
+		} else {
+			n = ring_set_push(t->set, id, objs, n, RING_B_VARIABLE);
+		}
+		if (n == 0)
+			sched_yield();
+		seq += n;
+	}
+	return NULL;
+}
+
+static void
+test_set(void) {
+	struct ring_set *set = (struct ring_set *)test_alloc(ring_set_memsize(70));
+	struct ring *r[70];
+	struct test_set t;
+	pthread_t tid[4];
+	void *args[4][2], *objs[64];
+	uint32_t next[4] = {0}, left, i, k, n;
+
+	assert(ring_set_memsize(0) == 0);
+	ring_set_init(set, 70);
+	for (i = 0; i < 70; i++) {
+		r[i] = (struct ring *)test_alloc(ring_memsize(16));
+		ring_init(r[i], 16, RING_F_SP | RING_F_SC);
+		/* A ring not empty when added is marked. */
+		if (i == 69)
+			assert(ring_push(r[i], objs, 1, RING_B_FIXED) == 1);
+		assert(ring_set_add(set, r[i], 2) == (int)i);
+	}
+	assert(ring_set_add(set, r[0], 0) == -1);
+	assert(ring_set_pop(set, objs, 64) == 1);
+	assert(ring_set_pop(set, objs, 64) == 0);
+
+	/* Round robin over the two bit words, weight 2 a turn. */
+	for (i = 0; i < 70; i += 3) {
+		objs[0] = (void *)(uintptr_t)(i * 2 + 1);
+		objs[1] = (void *)(uintptr_t)(i * 2 + 2);
+		objs[2] = objs[1];
+		assert(ring_set_push(set, i, objs, 3, RING_B_FIXED) == 3);
+	}
+	for (i = 0, left = 24 * 3; left; left -= n) {
+		n = ring_set_pop(set, objs, 64);
+		assert(n > 0 && n <= left);
+		if (left == 24 * 3) {
+			/* Two of each in ring order, then the third from ring 0 on. */
+			assert(n == 64);
+			for (k = 0; k < 48; k++)
+				assert(objs[k] == (void *)(uintptr_t)((k / 2) * 6 + k % 2 + 1));
+			for (; k < 64; k++)
+				assert(objs[k] == (void *)(uintptr_t)((k - 48) * 6 + 2));
+		}
+	}
+	assert(ring_set_pop(set, objs, 64) == 0);
+
+	/* Producers race the consumer clearing the bits of drained rings. */
+	ring_set_init(set, 4);
+	for (i = 0; i < 4; i++) {
+		ring_init(r[i], 16, RING_F_SP | RING_F_SC);
+		ring_set_add(set, r[i], i);
+	}
+	t.set = set;
+	t.nprod = 4;
+	for (i = 0; i < 4; i++) {
+		args[i][0] = &t;
+		args[i][1] = (void *)(uintptr_t)i;
+		pthread_create(&tid[i], NULL, test_set_producer, args[i]);
+	}
+	/* A lost mark would never be popped, as there is no full scan. */
+	for (left = 4 * TEST_OBJS; left; left -= n) {
+		n = ring_set_pop(set, objs, 1 + left % 16);
+		if (n == 0)
+			sched_yield();
+		for (k = 0; k < n; k++) {
+			uintptr_t v = (uintptr_t)objs[k] - 1;
+
+			assert(v >> 24 < 4 && (v & 0xffffff) == next[v >> 24]);
+			next[v >> 24]++;
+		}
+	}
+	for (i = 0; i < 4; i++)
+		pthread_join(tid[i], NULL);
+	assert(ring_set_pop(set, objs, 64) == 0);
+	for (i = 0; i < 70; i++)
+		free(r[i]);
+	free(set);
+	printf("set ok\n");
+}
+
+struct test_bcast {
+	struct ring_bcast *b;
+	unsigned reader;
+};
+
+static void *
+test_bcast_reader(void *arg) {
+	struct test_bcast *t = (struct test_bcast *)arg;
+	uint8_t e[8 * 12];
+	uint32_t seq = 0, n, i;
+
+	while (seq < TEST_OBJS) {
+		n = ring_bcast_pop(t->b, t->reader, e, 1 + (seq + t->reader) % 8, RING_B_VARIABLE);
+		if (n == 0)
+			sched_yield();
+		for (i = 0; i < n; i++)
+			test_check(e + i * 12, 12, seq + i);
+		seq += n;
+	}
+	return NULL;
+}
+
+static void
+test_bcast(void) {
+	struct ring_bcast *b = (struct ring_bcast *)test_alloc(ring_bcast_memsize(16, 12, 3));
+	struct test_bcast t[3];
+	pthread_t tid[3];
+	uint8_t e[16 * 12];
+	uint32_t seq = 0, got[3] = {0}, round, room, n, i, k;
+
+	assert(ring_bcast_memsize(16, 12, 0) == 0 && ring_bcast_memsize(12, 12, 1) == 0);
+	ring_bcast_init(b, 16, 12, 3);
+	assert(ring_bcast_pop(b, 0, e, 1, RING_B_VARIABLE) == 0);
+
+	/* Readers 0/1/2 pop at different rates, the slowest limits the room. */
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		n = 1 + round % 8;
+		for (i = 0; i < n; i++)
+			test_fill(e + i * 12, 12, seq + i);
+		k = ring_bcast_push(b, e, n, (round & 1) ? RING_B_VARIABLE : RING_B_FIXED);
+		room = got[0] < got[1] ? got[0] : got[1];
+		room = 15 - (seq - (room < got[2] ? room : got[2]));
+		if (round & 1)
+			assert(k == (n < room ? n : room));
+		else
+			assert(k == (n <= room ? n : 0));
+		seq += k;
+		for (i = 0; i < 3; i++) {
+			uint32_t want = 1 + (round * (i + 1)) % 10, j;
+
+			assert(ring_bcast_count(b, i) == seq - got[i]);
+			k = ring_bcast_pop(b, i, e, want, (round & 2) ? RING_B_VARIABLE : RING_B_FIXED);
+			if (round & 2)
+				assert(k == (want < seq - got[i] ? want : seq - got[i]));
+			else
+				assert(k == (want <= seq - got[i] ? want : 0));
+			for (j = 0; j < k; j++)
+				test_check(e + j * 12, 12, got[i] + j);
+			got[i] += k;
+		}
+	}
+
+	/* A producer and three reader threads. */
+	ring_bcast_init(b, 16, 12, 3);
+	for (i = 0; i < 3; i++) {
+		t[i].b = b;
+		t[i].reader = i;
+		pthread_create(&tid[i], NULL, test_bcast_reader, &t[i]);
+	}
+	for (seq = 0; seq < TEST_OBJS; seq += n) {
+		n = 1 + seq % 8;
+		if (n > TEST_OBJS - seq)
+			n = TEST_OBJS - seq;
+		for (i = 0; i < n; i++)
+			test_fill(e + i * 12, 12, seq + i);
+		n = ring_bcast_push(b, e, n, RING_B_VARIABLE);
+		if (n == 0)
+			sched_yield();
+	}
+	for (i = 0; i < 3; i++) {
+		pthread_join(tid[i], NULL);
+		assert(ring_bcast_count(b, i) == 0);
+	}
+	free(b);
+	printf("bcast ok\n");
+}
+
+static void *
+test_dyn_producer(void *arg) {
+	struct ring_dyn *d = (struct ring_dyn *)arg;
+	uint8_t e[16 * 8];
+	uint32_t seq = 0, n, i;
+
+	while (seq < TEST_OBJS) {
+		/* Bursts to grow it, then single pushes to let it shrink. */
+		n = (seq / 4096) & 1 ? 1 : 1 + seq % 16;
+		if (n > TEST_OBJS - seq)
+			n = TEST_OBJS - seq;
+		for (i = 0; i < n; i++)
+			test_fill(e + i * 8, 8, seq + i);
+		n = ring_dyn_push(d, e, n, RING_B_VARIABLE);
+		if (n == 0)
+			sched_yield();
+		seq += n;
+	}
+	return NULL;
+}
+
+static void
+test_dyn(void) {
+	struct ring_dyn *d;
+	pthread_t tid;
+	uint8_t e[128 * 8];
+	uint32_t pushed = 0, popped = 0, round, n, k, i;
+
+	assert(!ring_dyn_create(1, 64, 8) && !ring_dyn_create(8, 4, 8));
+	assert(!ring_dyn_create(6, 64, 8) && !ring_dyn_create(4, 64, 6));
+	d = ring_dyn_create(4, 64, 8);
+	assert(d && ring_dyn_size(d) == 4);
+
+	/* Grow one push at a time up to max, then full. */
+	for (;;) {
+		test_fill(e, 8, pushed);
+		if (ring_dyn_push(d, e, 1, RING_B_FIXED) == 0)
+			break;
+		pushed++;
+	}
+	assert(ring_dyn_size(d) == 64 && pushed == 3 + 7 + 15 + 31 + 63);
+	/* A fixed pop is all or none across the segments. */
+	assert(ring_dyn_pop(d, e, 20, RING_B_FIXED) == 20);
+	for (i = 0; i < 20; i++)
+		test_check(e + i * 8, 8, popped + i);
+	popped += 20;
+	assert(ring_dyn_pop(d, e, pushed - popped + 1, RING_B_FIXED) == 0);
+	assert(ring_dyn_pop(d, e, pushed - popped, RING_B_FIXED) == pushed - popped);
+	for (i = 0; i < pushed - popped; i++)
+		test_check(e + i * 8, 8, popped + i);
+	popped = pushed;
+	assert(ring_dyn_pop(d, e, 1, RING_B_VARIABLE) == 0);
+
+	/* Lightly used, it shrinks back to min across the wraparound. */
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		test_fill(e, 8, pushed);
+		assert(ring_dyn_push(d, e, 1, RING_B_FIXED) == 1);
+		pushed++;
+		assert(ring_dyn_pop(d, e, 1, RING_B_FIXED) == 1);
+		test_check(e, 8, popped++);
+	}
+	assert(ring_dyn_size(d) == 4);
+
+	/* A fixed batch over double grows to fit it, over max fails. */
+	for (i = 0; i < 20; i++)
+		test_fill(e + i * 8, 8, pushed + i);
+	assert(ring_dyn_push(d, e, 20, RING_B_FIXED) == 20 && ring_dyn_size(d) == 32);
+	pushed += 20;
+	assert(ring_dyn_push(d, e, 64, RING_B_FIXED) == 0);
+	k = ring_dyn_pop(d, e, 64, RING_B_VARIABLE);
+	assert(k == 20);
+	for (i = 0; i < k; i++)
+		test_check(e + i * 8, 8, popped + i);
+	ring_dyn_free(d);
+
+	/* A producer thread growing and shrinking under the consumer. */
+	d = ring_dyn_create(4, 256, 8);
+	assert(d);
+	pthread_create(&tid, NULL, test_dyn_producer, d);
+	for (popped = 0; popped < TEST_OBJS; popped += n) {
+		n = 1 + popped % 8;
+		if (n > TEST_OBJS - popped)
+			n = TEST_OBJS - popped;
+		n = ring_dyn_pop(d, e, n, (popped & 1) ? RING_B_FIXED : RING_B_VARIABLE);
+		if (n == 0)
+			sched_yield();
+		for (i = 0; i < n; i++)
+			test_check(e + i * 8, 8, popped + i);
+	}
+	pthread_join(tid, NULL);
+	assert(ring_dyn_pop(d, e, 1, RING_B_VARIABLE) == 0);
+	ring_dyn_free(d);
+	printf("dyn ok\n");
+}
+
+/* Numa rings, small and huge page aligned. */
+static void
+test_numa(void) {
+	static const unsigned counts[] = {64, 1u << 18};
+	struct ring *r;
+	uint8_t e[8 * 8];
+	uint32_t pushed, popped, round, c, n, i;
+	int node;
+
+	errno = 0;
+	assert(!ring_elem_create_numa(64, 8, 0, -2) && errno == EINVAL);
+	errno = 0;
+	assert(!ring_elem_create_numa(64, 8, 0, RING_NUMA_MAX_NODES) && errno == EINVAL);
+	errno = 0;
+	assert(!ring_elem_create_numa(60, 8, 0, -1) && errno == EINVAL);
+
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		for (node = -1; node <= 0; node++) {
+			r = ring_elem_create_numa(counts[c], 8, RING_F_SP | RING_F_SC, node);
+			/* Binding fails without numa support, the local policy does not. */
+			if (!r) {
+				assert(node == 0 && errno != EINVAL);
+				continue;
+			}
+			if (RING_HUGEPAGE_SIZE > 0 && ring_elem_memsize(counts[c], 8) >= RING_HUGEPAGE_SIZE)
+				assert((uintptr_t)((struct ring_numa *)r - 1) % RING_HUGEPAGE_SIZE == 0);
+			assert(node < 0 || ring_numa_node(r) == node);
+			assert(ring_avail(r) == counts[c] - 1);
+			for (round = pushed = popped = 0; round < TEST_ROUNDS; round++) {
+				n = 1 + round % 8;
+				for (i = 0; i < n; i++)
+					test_fill(e + i * 8, 8, pushed + i);
+				assert(ring_elem_push(r, e, n, RING_B_FIXED) == n);
+				pushed += n;
+				n = ring_elem_pop(r, e, 1 + round * 3 % 8, RING_B_VARIABLE);
+				for (i = 0; i < n; i++)
+					test_check(e + i * 8, 8, popped + i);
+				popped += n;
+			}
+			ring_free_numa(r);
+		}
+	}
+	printf("numa ok\n");
+}
+
+/* Bytes of a message record from its sequence number. */
+static void
+test_msg_fill(uint8_t *p, unsigned len, uint32_t seq) {
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		p[i] = (uint8_t)(seq * 31 + i);
+}
+
+static void
+test_msg_check(const uint8_t *p, unsigned len, uint32_t seq) {
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		assert(p[i] == (uint8_t)(seq * 31 + i));
+}
+
+/* Records of a message ring producer thread, id and seq first. */
+struct test_msg_rec {
+	uint32_t id;
+	uint32_t seq;
+};
+
+static void *
+test_msg_producer(void *arg) {
+	struct ring *r = (struct ring *)((void **)arg)[0];
+	uint32_t id = (uint32_t)(uintptr_t)((void **)arg)[1], seq = 0;
+	struct test_msg_rec *m;
+	unsigned len;
+
+	while (seq < TEST_OBJS) {
+		len = sizeof(*m) + (seq * 7 + id) % 100;
+		m = (struct test_msg_rec *)ring_msg_reserve(r, len);
+		if (!m) {
+			sched_yield();
+			continue;
+		}
+		m->id = id;
+		m->seq = seq;
+		test_msg_fill((uint8_t *)(m + 1), len - sizeof(*m), seq);
+		ring_msg_commit(r, m);
+		seq++;
+	}
+	return NULL;
+}
+
+static void
+test_msg(void) {
+	struct ring *r = (struct ring *)test_alloc(ring_msg_memsize(256));
+	const uint8_t *end = (const uint8_t *)r->ring + 256;
+	const uint8_t *p, *last = NULL;
+	void *m[4];
+	uint32_t pushed = 0, popped = 0, round, wraps = 0, next[2] = {0}, i, k;
+	unsigned len, want;
+	pthread_t tid[2];
+	void *args[2][2];
+
+	assert(ring_msg_memsize(8) == 0 && ring_msg_memsize(24) == 0);
+	ring_msg_init(r, 256, RING_F_SP);
+	assert(!ring_msg_read(r, &len));
+	assert(!ring_msg_reserve(r, 256 / 2 - 7));
+	m[0] = ring_msg_reserve(r, 256 / 2 - 8);
+	assert(m[0]);
+	ring_msg_commit(r, m[0]);
+	assert(ring_msg_read(r, &len) == m[0] && len == 256 / 2 - 8);
+	ring_msg_release(r);
+
+	/* Up to 4 reservations of a single producer, committed in order. */
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		k = 1 + round % 4;
+		for (i = 0; i < k; i++) {
+			want = (pushed + i) * 13 % 60;
+			m[i] = ring_msg_reserve(r, want);
+			if (!m[i])
+				break;
+			/* A record never wraps around the ring end. */
+			assert((const uint8_t *)m[i] + want <= end);
+			test_msg_fill((uint8_t *)m[i], want, pushed + i);
+		}
+		for (k = 0; k < i; k++)
+			ring_msg_commit(r, m[k]);
+		pushed += i;
+		for (k = 0; k < 1 + round % 3 && popped < pushed; k++) {
+			p = (const uint8_t *)ring_msg_read(r, &len);
+			assert(p && len == popped * 13 % 60);
+			test_msg_check(p, len, popped);
+			/* Read again before release, the same record. */
+			assert(ring_msg_read(r, &len) == p && len == popped * 13 % 60);
+			wraps += last && p < last;
+			last = p;
+			ring_msg_release(r);
+			popped++;
+		}
+	}
+	while ((p = (const uint8_t *)ring_msg_read(r, &len)) != NULL) {
+		assert(len == popped * 13 % 60);
+		test_msg_check(p, len, popped);
+		ring_msg_release(r);
+		popped++;
+	}
+	assert(popped == pushed && wraps > 0 && ring_empty(r));
+
+	/* Two producer threads, records of any length and padding. */
+	ring_msg_init(r, 256, 0);
+	for (i = 0; i < 2; i++) {
+		args[i][0] = r;
+		args[i][1] = (void *)(uintptr_t)i;
+		pthread_create(&tid[i], NULL, test_msg_producer, args[i]);
+	}
+	for (popped = 0; popped < 2 * TEST_OBJS;) {
+		const struct test_msg_rec *rec = (const struct test_msg_rec *)ring_msg_read(r, &len);
+
+		if (!rec) {
+			sched_yield();
+			continue;
+		}
+		assert(rec->id < 2 && rec->seq == next[rec->id]);
+		assert(len == sizeof(*rec) + (rec->seq * 7 + rec->id) % 100);
+		test_msg_check((const uint8_t *)(rec + 1), len - sizeof(*rec), rec->seq);
+		next[rec->id]++;
+		ring_msg_release(r);
+		popped++;
+	}
+	for (i = 0; i < 2; i++)
+		pthread_join(tid[i], NULL);
+	assert(!ring_msg_read(r, &len));
+	free(r);
+	printf("msg ok\n");
+}
+
+struct test_mempool {
+	struct ring_mempool *mp;
+	unsigned char *inuse;	/* Per object, set while a thread holds it. */
+};
+
+/* Index of object p of mp, checked to be an object start. */
+static unsigned
+test_mempool_idx(const struct ring_mempool *mp, const void *p) {
+	size_t off = (size_t)((const uint8_t *)p - mp->objs);
+
+	assert((const uint8_t *)p >= mp->objs && off % mp->obj_size == 0 && off / mp->obj_size < mp->n);
+	return (unsigned)(off / mp->obj_size);
+}
+
+static void *
+test_mempool_thread(void *arg) {
+	struct test_mempool *t = (struct test_mempool *)((void **)arg)[0];
+	uint32_t id = (uint32_t)(uintptr_t)((void **)arg)[1], round, n, i;
+	struct ring_mempool_cache *c = (struct ring_mempool_cache *)malloc(sizeof(*c));
+	void *objs[40];
+
+	assert(c);
+	ring_mempool_cache_init(c, 8 + id * 8);
+	for (round = 0; round < TEST_OBJS / 4; round++) {
+		n = 1 + (round + id) % 40;
+		if (ring_mempool_get(t->mp, c, objs, n) != n) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			assert(!__atomic_exchange_n(&t->inuse[test_mempool_idx(t->mp, objs[i])], 1, __ATOMIC_RELAXED));
+			memset(objs[i], (int)id, 24);
+		}
+		for (i = 0; i < n; i++) {
+			assert(((uint8_t *)objs[i])[0] == id && ((uint8_t *)objs[i])[23] == id);
+			__atomic_store_n(&t->inuse[test_mempool_idx(t->mp, objs[i])], 0, __ATOMIC_RELAXED);
+		}
+		ring_mempool_put(t->mp, c, objs, n);
+	}
+	ring_mempool_cache_flush(t->mp, c);
+	free(c);
+	return NULL;
+}
+
+static void
+test_mempool(void) {
+	struct ring_mempool *mp;
+	struct ring_mempool_cache *c = (struct ring_mempool_cache *)malloc(sizeof(*c));
+	struct test_mempool t;
+	unsigned char seen[100];
+	pthread_t tid[3];
+	void *args[3][2], *objs[100];
+	unsigned held = 0, round, n, i;
+
+	assert(c);
+	assert(!ring_mempool_create(0, 8, 0) && !ring_mempool_create(10, 0, 0));
+	mp = ring_mempool_create(100, 20, 0);
+	assert(mp && mp->obj_size == 24 && ring_mempool_avail(mp) == 100);
+
+	/* Without a cache, every object once, then empty. */
+	assert(ring_mempool_get(mp, NULL, objs, 100) == 100);
+	memset(seen, 0, sizeof(seen));
+	for (i = 0; i < 100; i++) {
+		n = test_mempool_idx(mp, objs[i]);
+		assert(!seen[n]);
+		seen[n] = 1;
+	}
+	assert(ring_mempool_avail(mp) == 0 && ring_mempool_get(mp, NULL, objs, 1) == 0);
+	ring_mempool_put(mp, NULL, objs, 100);
+	assert(ring_mempool_avail(mp) == 100);
+
+	/* Through a cache of 16, gets over it bypass it, objects never held twice. */
+	ring_mempool_cache_init(c, 16);
+	memset(seen, 0, sizeof(seen));
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		n = 1 + round * 7 % 24;
+		if (round & 1) {
+			if (n > held)
+				n = held;
+			ring_mempool_put(mp, c, objs + held - n, n);
+			for (i = held - n; i < held; i++)
+				seen[test_mempool_idx(mp, objs[i])] = 0;
+			held -= n;
+		} else if (ring_mempool_get(mp, c, objs + held, n) == n) {
+			for (i = held; i < held + n; i++) {
+				assert(!seen[test_mempool_idx(mp, objs[i])]);
+				seen[test_mempool_idx(mp, objs[i])] = 1;
+			}
+			held += n;
+		} else {
+			/* Fails only if the pool, and the cache if used, have fewer than n. */
+			assert(ring_mempool_avail(mp) + (n > c->size ? 0 : c->len) < n);
+		}
+		assert(c->len <= 2 * c->size);
+		assert(ring_mempool_avail(mp) + c->len + held == 100);
+	}
+	ring_mempool_put(mp, c, objs, held);
+	ring_mempool_cache_flush(mp, c);
+	assert(c->len == 0 && ring_mempool_avail(mp) == 100);
+	ring_mempool_free(mp);
+
+	/* Threads of different cache sizes sharing a small pool. */
+	t.mp = ring_mempool_create(96, 24, 0);
+	t.inuse = (unsigned char *)calloc(96, 1);
+	assert(t.mp && t.inuse);
+	for (i = 0; i < 3; i++) {
+		args[i][0] = &t;
+		args[i][1] = (void *)(uintptr_t)i;
+		pthread_create(&tid[i], NULL, test_mempool_thread, args[i]);
+	}
+	for (i = 0; i < 3; i++)
+		pthread_join(tid[i], NULL);
+	assert(ring_mempool_avail(t.mp) == 96);
+	free(t.inuse);
+	ring_mempool_free(t.mp);
+	free(c);
+	printf("mempool ok\n");
+}
+
+struct test_deque {
+	struct ring_deque *d;
+	unsigned long taken;
+	unsigned char *seen;
+};
+
+/* Mark object o of the deque test as taken, once only. */
+static void
+test_deque_take(struct test_deque *t, void *o) {
+	uintptr_t v = (uintptr_t)o - 1;
+
+	assert(v < TEST_OBJS);
+	assert(!__atomic_exchange_n(&t->seen[v], 1, __ATOMIC_RELAXED));
+	__atomic_add_fetch(&t->taken, 1, __ATOMIC_RELAXED);
+}
+
+/* Thief 0 steals one by one, thief 1 by halves into its own ring. */
+static void *
+test_deque_thief(void *arg) {
+	struct test_deque *t = (struct test_deque *)((void **)arg)[0];
+	uint32_t id = (uint32_t)(uintptr_t)((void **)arg)[1], n, i;
+	struct ring *r = (struct ring *)test_alloc(ring_memsize(32));
+	void *objs[32], *o;
+
+	ring_init(r, 32, RING_F_SP | RING_F_SC);
+	while (__atomic_load_n(&t->taken, __ATOMIC_RELAXED) < TEST_OBJS) {
+		if (id == 0) {
+			if ((o = ring_deque_steal(t->d)))
+				test_deque_take(t, o);
+			else
+				sched_yield();
+			continue;
+		}
+		if (ring_deque_steal_half(t->d, r) == 0) {
+			sched_yield();
+			continue;
+		}
+		n = ring_pop(r, objs, 32, RING_B_VARIABLE);
+		for (i = 0; i < n; i++)
+			test_deque_take(t, objs[i]);
+	}
+	assert(ring_empty(r));
+	free(r);
+	return NULL;
+}
+
+static void
+test_deque(void) {
+	struct ring_deque *d = (struct ring_deque *)test_alloc(ring_deque_memsize(16));
+	struct ring *r = (struct ring *)test_alloc(ring_memsize(64));
+	struct test_deque t;
+	pthread_t tid[2];
+	void *args[2][2], *objs[16], *o;
+	uint32_t seq, i;
+
+	assert(ring_deque_memsize(1) == 0 && ring_deque_memsize(12) == 0);
+
+	/* The owner pops the newest, thieves steal the oldest, 16 at most. */
+	ring_deque_init(d, 16);
+	assert(!ring_deque_pop(d) && !ring_deque_steal(d) && ring_deque_count(d) == 0);
+	for (i = 0; i < 16; i++)
+		assert(ring_deque_push(d, TEST_SET_OBJ(0, i)));
+	assert(!ring_deque_push(d, TEST_SET_OBJ(0, 16)) && ring_deque_count(d) == 16);
+	for (i = 0; i < 8; i++) {
+		assert(ring_deque_steal(d) == TEST_SET_OBJ(0, i));
+		assert(ring_deque_pop(d) == TEST_SET_OBJ(0, 15 - i));
+	}
+	assert(!ring_deque_pop(d) && !ring_deque_steal(d));
+	/* Top and bottom moved, the slots wrap. */
+	for (i = 0; i < 16; i++)
+		assert(ring_deque_push(d, TEST_SET_OBJ(0, i)));
+	for (i = 0; i < 16; i++)
+		assert(ring_deque_steal(d) == TEST_SET_OBJ(0, i));
+	assert(ring_deque_count(d) == 0);
+
+	/* Half rounded up, oldest first, no more than the ring has room for. */
+	ring_init(r, 64, RING_F_SP | RING_F_SC);
+	assert(ring_deque_steal_half(d, r) == 0);
+	for (i = 0; i < 9; i++)
+		assert(ring_deque_push(d, TEST_SET_OBJ(0, i)));
+	assert(ring_deque_steal_half(d, r) == 5 && ring_deque_count(d) == 4);
+	assert(ring_pop(r, objs, 16, RING_B_VARIABLE) == 5);
+	for (i = 0; i < 5; i++)
+		assert(objs[i] == TEST_SET_OBJ(0, i));
+	for (i = 0; i < 61; i++)
+		assert(ring_push(r, objs, 1, RING_B_FIXED) == 1);
+	assert(ring_avail(r) == 2);
+	assert(ring_deque_steal_half(d, r) == 2 && ring_deque_count(d) == 2);
+	assert(ring_pop(r, objs, 16, RING_B_VARIABLE) == 16);
+	ring_init(r, 64, RING_F_SP | RING_F_SC);
+	assert(ring_deque_pop(d) == TEST_SET_OBJ(0, 8));
+	assert(ring_deque_steal_half(d, r) == 1);
+	assert(ring_pop(r, objs, 16, RING_B_VARIABLE) == 1 && objs[0] == TEST_SET_OBJ(0, 7));
+	assert(ring_deque_count(d) == 0);
+
+	/* The owner pushes and pops while two thieves race it for the last ones. */
+	ring_deque_init(d, 16);
+	t.d = d;
+	t.taken = 0;
+	t.seen = (unsigned char *)calloc(TEST_OBJS, 1);
+	assert(t.seen);
+	for (i = 0; i < 2; i++) {
+		args[i][0] = &t;
+		args[i][1] = (void *)(uintptr_t)i;
+		pthread_create(&tid[i], NULL, test_deque_thief, args[i]);
+	}
+	for (seq = 0; seq < TEST_OBJS; seq++) {
+		while (!ring_deque_push(d, TEST_SET_OBJ(0, seq))) {
+			if ((o = ring_deque_pop(d)))
+				test_deque_take(&t, o);
+		}
+		/* Keep the deque short, so pops often race for the last object. */
+		if (seq % 3 == 0 && (o = ring_deque_pop(d)))
+			test_deque_take(&t, o);
+	}
+	while ((o = ring_deque_pop(d)))
+		test_deque_take(&t, o);
+	for (i = 0; i < 2; i++)
+		pthread_join(tid[i], NULL);
+	assert(t.taken == TEST_OBJS && ring_deque_count(d) == 0);
+	for (i = 0; i < TEST_OBJS; i++)
+		assert(t.seen[i]);
+	free(t.seen);
+	free(r);
+	free(d);
+	printf("deque ok\n");
+}
+
+/* Snapshot a ring holding a wrapped range, restore it into a new one. */
+static void
+test_snap_ring(FILE *f, unsigned count, unsigned esize, unsigned flags) {
+	static uint8_t buf[64 * 64];
+	struct ring *r = (struct ring *)test_alloc(ring_elem_memsize(count, esize));
+	struct ring *r2 = (struct ring *)test_alloc(ring_elem_memsize(count, esize));
+	uint32_t i;
+
+	ring_elem_init(r, count, esize, flags);
+	ring_elem_init(r2, count, esize, flags);
+	for (i = 0; i < 50; i++)
+		test_fill(buf + i * esize, esize, i);
+	assert(ring_elem_push(r, buf, 40, RING_B_FIXED) == 40);
+	assert(ring_elem_pop(r, buf, 30, RING_B_FIXED) == 30);
+	for (i = 0; i < 50; i++)
+		test_fill(buf + i * esize, esize, 40 + i);
+	assert(ring_elem_push(r, buf, 50, RING_B_FIXED) == 50);
+
+	rewind(f);
+	assert(ftruncate(fileno(f), 0) == 0);
+	assert(ring_snapshot(r, fileno(f)) == 0);
+	assert(lseek(fileno(f), 0, SEEK_SET) == 0);
+	assert(ring_restore(r2, fileno(f)) == 0);
+	assert(ring_count(r2) == 60 && r2->cons.tail == r->cons.tail);
+	assert(ring_elem_pop(r2, buf, 60, RING_B_FIXED) == 60);
+	for (i = 0; i < 60; i++)
+		test_check(buf + i * esize, esize, 30 + i);
+	/* The restored ring runs on from the snapshot indexes. */
+	assert(ring_elem_push(r2, buf, 60, RING_B_FIXED) == 60 && ring_count(r2) == 60);
+	assert(ring_count(r) == 60);
+	free(r2);
+	free(r);
+}
+
+static void
+test_snap(void) {
+	FILE *f = tmpfile();
+	struct ring *r = (struct ring *)test_alloc(ring_elem_memsize(128, 16));
+	struct ring *r2 = (struct ring *)test_alloc(ring_elem_memsize(128, 16));
+	struct ring_zc_data zcd;
+	uint8_t e[16];
+	off_t len;
+	int fd;
+
+	assert(f);
+	fd = fileno(f);
+	test_snap_ring(f, 64, 8, 0);
+	test_snap_ring(f, 64, 12, RING_F_SP | RING_F_SC);
+	test_snap_ring(f, 128, 8, RING_F_SP | RING_F_SC | RING_F_SCRAMBLE);
+#ifndef RING_INDEX64
+	test_snap_ring(f, 64, 16, RING_F_MP_RTS | RING_F_MC_RTS);
+	test_snap_ring(f, 64, 16, RING_F_MP_HTS | RING_F_MC_HTS);
+#endif
+
+	/* A snapshot of 64 slots of 8 bytes. */
+	ring_elem_init(r, 64, 8, 0);
+	test_fill(e, 8, 1);
+	assert(ring_elem_push(r, e, 1, RING_B_FIXED) == 1);
+	assert(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+	assert(ring_snapshot(r, fd) == 0);
+	len = lseek(fd, 0, SEEK_CUR);
+
+	/* Another geometry does not match. */
+	ring_elem_init(r2, 64, 16, 0);
+	assert(lseek(fd, 0, SEEK_SET) == 0);
+	errno = 0;
+	assert(ring_restore(r2, fd) == -1 && errno == EPROTO);
+	ring_elem_init(r2, 128, 8, 0);
+	assert(lseek(fd, 0, SEEK_SET) == 0);
+	errno = 0;
+	assert(ring_restore(r2, fd) == -1 && errno == EPROTO);
+
+	/* A ring holding elements is not idle, fd is not read. */
+	ring_elem_init(r2, 64, 8, 0);
+	assert(ring_elem_push(r2, e, 1, RING_B_FIXED) == 1);
+	assert(lseek(fd, 0, SEEK_SET) == 0);
+	errno = 0;
+	assert(ring_restore(r2, fd) == -1 && errno == EBUSY);
+	assert(lseek(fd, 0, SEEK_CUR) == 0 && ring_count(r2) == 1);
+
+	/* Nor one with a push in progress, until it is finished. */
+	ring_elem_init(r2, 64, 8, RING_F_SP | RING_F_SC);
+	assert(ring_push_start(r2, 1, RING_B_FIXED, &zcd) == 1);
+	errno = 0;
+	assert(ring_restore(r2, fd) == -1 && errno == EBUSY);
+	ring_push_finish(r2, 0);
+	assert(ring_restore(r2, fd) == 0 && ring_count(r2) == 1);
+#ifndef RING_INDEX64
+	ring_elem_init(r2, 64, 8, RING_F_MP_HTS | RING_F_MC_HTS);
+	assert(ring_push_start(r2, 1, RING_B_FIXED, &zcd) == 1);
+	assert(lseek(fd, 0, SEEK_SET) == 0);
+	errno = 0;
+	assert(ring_restore(r2, fd) == -1 && errno == EBUSY);
+	ring_push_finish(r2, 0);
+	assert(ring_restore(r2, fd) == 0 && ring_count(r2) == 1);
+#endif
+
+	/* A truncated snapshot leaves the ring empty. */
+	assert(ftruncate(fd, len - 4) == 0);
+	ring_elem_init(r2, 64, 8, 0);
+	assert(lseek(fd, 0, SEEK_SET) == 0);
+	errno = 0;
+	assert(ring_restore(r2, fd) == -1 && errno == EIO);
+	assert(ring_empty(r2));
+
+	fclose(f);
+	free(r2);
+	free(r);
+	printf("snap ok\n");
+}
+
+static void *
+test_prio_producer(void *arg) {
+	struct ring_prio *p = (struct ring_prio *)((void **)arg)[0];
+	uint32_t lane = (uint32_t)(uintptr_t)((void **)arg)[1], seq = 0, n, i;
+	void *objs[4];
+
+	while (seq < TEST_OBJS) {
+		n = 1 + seq % 4;
+		if (n > TEST_OBJS - seq)
+			n = TEST_OBJS - seq;
+		for (i = 0; i < n; i++)
+			objs[i] = TEST_SET_OBJ(lane, seq + i);
+		n = ring_prio_push(p, lane, objs, n, RING_B_VARIABLE);
+		if (n == 0)
+			sched_yield();
+		seq += n;
+	}
+	return NULL;
+}
+
+static void
+test_prio(void) {
+	struct ring_prio *p = (struct ring_prio *)test_alloc(ring_prio_memsize(4, 128));
+	pthread_t tid[3];
+	void *args[3][2], *objs[64];
+	uint32_t next[4] = {0}, left, lane, seq, n, i, k;
+
+	assert(ring_prio_memsize(0, 16) == 0 && ring_prio_memsize(RING_PRIO_MAX_LANES + 1, 16) == 0);
+	assert(ring_prio_memsize(4, 0) == 0);
+	assert(ring_prio_memsize(4, 100) == ring_prio_memsize(4, 128));
+	errno = 0;
+	assert(ring_prio_init(p, 4, 100, 0) == -1 && errno == EINVAL);
+	errno = 0;
+	assert(ring_prio_init(p, 0, 128, 0) == -1 && errno == EINVAL);
+	assert(ring_prio_init(p, 4, 100, RING_F_EXACT_SZ) == 0);
+	for (i = 0; i < 4; i++)
+		assert(ring_avail(ring_prio_lane(p, i)) == 100);
+	assert(ring_prio_pop(p, objs, 64) == 0);
+
+	/* Strict lanes pop in priority order, whatever the push order. */
+	assert(ring_prio_init(p, 4, 128, 0) == 0);
+	for (lane = 4; lane-- > 0;) {
+		for (i = 0; i < 5; i++)
+			objs[i] = TEST_SET_OBJ(lane, i);
+		assert(ring_prio_push(p, lane, objs, 5, RING_B_FIXED) == 5);
+	}
+	assert(ring_prio_pop(p, objs, 64) == 20);
+	for (i = 0; i < 20; i++)
+		assert(objs[i] == TEST_SET_OBJ(i / 5, i % 5));
+	assert(ring_prio_pop(p, objs, 64) == 0);
+
+	/* Weighted lanes 1 and 2 share 2:1 what strict lane 0 leaves. */
+	ring_prio_set_weight(p, 1, 2);
+	ring_prio_set_weight(p, 2, 1);
+	for (seq = 0; seq < 60; seq += 6) {
+		for (i = 0; i < 6; i++)
+			objs[i] = TEST_SET_OBJ(1, seq + i);
+		assert(ring_prio_push(p, 1, objs, 6, RING_B_FIXED) == 6);
+		for (i = 0; i < 6; i++)
+			objs[i] = TEST_SET_OBJ(2, seq + i);
+		assert(ring_prio_push(p, 2, objs, 6, RING_B_FIXED) == 6);
+	}
+	memset(next, 0, sizeof(next));
+	for (k = 0; k < 10; k++) {
+		if (k == 5) {
+			/* A strict lane goes first as soon as it has objects. */
+			objs[0] = TEST_SET_OBJ(0, 0);
+			assert(ring_prio_push(p, 0, objs, 1, RING_B_FIXED) == 1);
+			assert(ring_prio_pop(p, objs, 1) == 1 && objs[0] == TEST_SET_OBJ(0, 0));
+		}
+		assert(ring_prio_pop(p, objs, 3) == 3);
+		for (i = 0; i < 3; i++) {
+			uintptr_t v = (uintptr_t)objs[i] - 1;
+
+			assert((v >> 24) == (i < 2 ? 1u : 2u) && (v & 0xffffff) == next[v >> 24]);
+			next[v >> 24]++;
+		}
+	}
+	while ((n = ring_prio_pop(p, objs, 64)) > 0)
+		;
+	assert(ring_count(ring_prio_lane(p, 1)) == 0 && ring_count(ring_prio_lane(p, 2)) == 0);
+
+	/* Producers of three lanes race the consumer clearing the bits. */
+	assert(ring_prio_init(p, 4, 16, 0) == 0);
+	ring_prio_set_weight(p, 2, 4);
+	for (i = 0; i < 3; i++) {
+		args[i][0] = p;
+		args[i][1] = (void *)(uintptr_t)(i + 1);
+		pthread_create(&tid[i], NULL, test_prio_producer, args[i]);
+	}
+	/* A lost mark would never be popped, as there is no full scan. */
+	memset(next, 0, sizeof(next));
+	for (left = 3 * TEST_OBJS; left; left -= n) {
+		n = ring_prio_pop(p, objs, 1 + left % 16);
+		if (n == 0)
+			sched_yield();
+		for (k = 0; k < n; k++) {
+			uintptr_t v = (uintptr_t)objs[k] - 1;
+
+			assert(v >> 24 >= 1 && v >> 24 <= 3 && (v & 0xffffff) == next[v >> 24]);
+			next[v >> 24]++;
+		}
+	}
+	for (i = 0; i < 3; i++)
+		pthread_join(tid[i], NULL);
+	assert(ring_prio_pop(p, objs, 64) == 0);
+	free(p);
+	printf("prio ok\n");
+}
+
+/* Shared memory rings, two mappings and a child process. */
+static void
+test_shm(void) {
+	struct ring *r, *a, *c;
+	struct ring_shm *shm;
+	char name[64];
+	uint8_t e[8 * 16];
+	uint32_t pushed = 0, popped = 0, round, n, i;
+	pid_t pid;
+	int status;
+
+	snprintf(name, sizeof(name), "/ring_test.%d", (int)getpid());
+	ring_unlink_shm(name);
+	r = ring_elem_create_shm(name, 64, 16, 0);
+	assert(r);
+	assert(!ring_elem_create_shm(name, 64, 16, 0) && errno == EEXIST);
+	a = ring_attach_shm(name);
+	assert(a && a != r && ring_avail(a) == 63);
+
+	/* Push in one mapping, pop in the other, across the wraparound. */
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		n = 1 + round % 8;
+		for (i = 0; i < n; i++)
+			test_fill(e + i * 16, 16, pushed + i);
+		assert(ring_elem_push(r, e, n, RING_B_FIXED) == n);
+		pushed += n;
+		assert(ring_count(a) == pushed - popped);
+		n = ring_elem_pop(a, e, 1 + round * 3 % 8, RING_B_VARIABLE);
+		for (i = 0; i < n; i++)
+			test_check(e + i * 16, 16, popped + i);
+		popped += n;
+	}
+	while ((n = ring_elem_pop(a, e, 8, RING_B_VARIABLE)) > 0) {
+		for (i = 0; i < n; i++)
+			test_check(e + i * 16, 16, popped + i);
+		popped += n;
+	}
+	assert(popped == pushed && ring_empty(r));
+
+	/* A child attaches and pushes, the parent pops. */
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		c = ring_attach_shm(name);
+		if (!c)
+			_exit(1);
+		for (i = 0; i < TEST_OBJS;) {
+			test_fill(e, 16, i);
+			if (ring_elem_push(c, e, 1, RING_B_FIXED))
+				i++;
+			else
+				sched_yield();
+		}
+		ring_detach_shm(c);
+		_exit(0);
+	}
+	for (popped = 0; popped < TEST_OBJS;) {
+		n = ring_elem_pop(a, e, 8, RING_B_VARIABLE);
+		if (n == 0)
+			sched_yield();
+		for (i = 0; i < n; i++)
+			test_check(e + i * 16, 16, popped + i);
+		popped += n;
+	}
+	assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	assert(ring_empty(a));
+
+	/* Headers of another layout do not attach. */
+	shm = (struct ring_shm *)r - 1;
+	shm->version++;
+	assert(!ring_attach_shm(name) && errno == EPROTO);
+	shm->version--;
+	shm->count *= 2;
+	assert(!ring_attach_shm(name) && errno == EPROTO);
+	shm->count /= 2;
+	r->cons.esize = 8;
+	assert(!ring_attach_shm(name) && errno == EPROTO);
+	r->cons.esize = 16;
+	shm->magic = 0;
+	assert(!ring_attach_shm(name) && errno == EAGAIN);
+	shm->magic = RING_SHM_MAGIC;
+	c = ring_attach_shm(name);
+	assert(c);
+	ring_detach_shm(c);
+
+	ring_detach_shm(a);
+	ring_detach_shm(r);
+	assert(ring_unlink_shm(name) == 0);
+	assert(!ring_attach_shm(name) && errno == ENOENT);
+	assert(ring_unlink_shm(name) == -1);
+	printf("shm ok\n");
+}
+
+int
+main(void) {
+	test_elem();
+	test_elem_mt();
+	test_zc();
+#ifndef RING_INDEX64
+	test_zc_mt();
+#endif
+	test_peek();
+	test_shm();
+	test_set();
+	test_prio();
+	test_bcast();
+	test_dyn();
+	test_numa();
+	test_msg();
+	test_mempool();
+	test_deque();
+	test_snap();
+	printf("all ok\n");
+	return 0;
+}